@@ -0,0 +1,147 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      analysis.h
+   Description: NDVI analysis stages used by planthealth
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <vector>
+#include "mask.h"
+
+class ThreadPool;
+class StageTimings;
+struct NDVIKernels;
+
+
+// NDVI of every 8-bit (IR, blue) pair, indexed by ir << 8 | blue. A black pixel (0/0) has NDVI 0
+const float* ndviTable();
+
+// Scaled 0-255 bin of every (IR, blue) pair for the NDVI range [min, max]
+void scaleTable(const float min, const float max, std::vector<unsigned char>& pairBin);
+
+
+// Reference stages: each one is a full pass over the image and returns a full size buffer
+std::vector<float> calculateNDVI(const std::vector<unsigned char>& image, const int Width, const int Height);
+void minMax(const std::vector<float>& image, const int Width, const int Height, float& min, float& max);
+std::vector<float> scaleImage(const std::vector<float>& image, const int Width, const int Height, const float min, const float max);
+int otsu_threshold(const std::vector<float>& scaled, int Width, int Height);
+VegetationMask thresholdImage(const std::vector<float>& image, const int Width, const int Height, const int threshold);
+float sumVegetationIndex(const std::vector<float>&ndvi_raw, const VegetationMask& bitmap);
+
+// Otsu threshold of an already gathered 256 bin histogram of total pixels
+int otsuFromHistogram(const std::vector<uint64_t>& histogram, uint64_t total);
+
+
+// Compact state of the fused analysis engine.
+// Every per-pixel quantity is a function of the (IR, blue) pair of the pixel, so the engine
+// keeps one entry per pair (index ir << 8 | blue) instead of full size float images.
+struct NDVIAnalysis
+{
+  float min, max;                           // NDVI bounds, as minMax()
+  int threshold;                            // Otsu threshold on the scaled 0-255 image
+  float totalVegIndex;                      // sum of NDVI over vegetation pixels
+  std::vector<uint64_t> pairCount;          // 65536 pixel counts per (IR, blue) pair
+  std::vector<unsigned char> pairBin;       // scaled 0-255 NDVI per pair
+  std::vector<unsigned char> pairVegetation; // 1 if the pair is above the threshold
+
+  // Scratch of the engines, kept with the result so that a series of frames of one size allocates
+  // nothing after the first
+  std::vector<std::vector<unsigned> > workerCount; // (IR, blue) histogram per pool worker, 32-bit to stay in
+                                                   // cache, folded into workerTotal before it can overflow
+  std::vector<std::vector<uint64_t> > workerTotal; // folded counts, empty until a worker passes 2^32 pixels
+  std::vector<uint64_t> workerPixels;              // pixels in workerCount since the last fold
+  std::vector<unsigned char> workerUsed;           // 1 once the worker's histogram is cleared for this frame
+  std::vector<float> bandMin, bandMax;             // NDVI bounds per row band
+  std::vector<double> bandSum;                     // vegetation sum per row band
+  std::vector<uint64_t> binCount;                  // 256 bin histogram of the scaled NDVI for Otsu
+};
+
+// Fused engine: one streaming pass over the IR and blue planes (Width * Height bytes each, see loadPNG)
+// gathers NDVI, min/max and the pair histogram, the threshold is then found from the compact state and
+// a second pass over the planes sums the vegetation NDVI. Both passes run over fixed row bands on the
+// pool (or the calling thread if there is none) and the partials are merged in band order, so the metric
+// does not depend on the thread count.
+// With timings each stage is recorded as it runs (see timings.h).
+void analyseNDVI(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                 const int Width, const int Height, NDVIAnalysis& result, ThreadPool* pool = 0,
+                 StageTimings* timings = 0);
+
+// Histogram domain engine: a single integer-only pass builds the (IR, blue) histogram and every statistic,
+// including the vegetation sum, is then computed over the 65536 pairs. Faster than analyseNDVI, but the
+// sum is accumulated per pair instead of per band so the metric can differ by rounding.
+void analyseNDVIHistogram(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                          const int Width, const int Height, NDVIAnalysis& result, ThreadPool* pool = 0,
+                          StageTimings* timings = 0);
+
+// Streaming engine: rows are added as they are decoded and only the (IR, blue) histogram is kept, so the
+// memory used does not grow with the image. finish() computes the statistics as analyseNDVIHistogram does
+// and gives the same metric.
+class NDVIAccumulator
+{
+public:
+  NDVIAccumulator();
+
+  // Add one row of Width pixels from the IR and blue planes
+  void addRow(const unsigned char* ir, const unsigned char* blue, const int Width);
+
+  void finish(NDVIAnalysis& result, StageTimings* timings = 0) const;
+
+private:
+  const NDVIKernels* kernels; // chosen by the constructor, so rows can be added on any thread
+  std::vector<uint64_t> pairCount; // 64-bit, as an orthomosaic can pass 2^32 pixels
+  std::vector<unsigned> rowCount;  // 32-bit counts of the latest rows, folded into pairCount before they overflow
+  uint64_t rowPixels;              // pixels in rowCount
+  uint64_t npixels;
+};
+
+// Render the scaled NDVI image as one greyscale byte per pixel
+std::vector<unsigned char> renderNDVI(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                                      const int Width, const int Height,
+                                      const NDVIAnalysis& analysis, ThreadPool* pool = 0);
+
+// Same, into output, which keeps its capacity from an earlier frame
+void renderNDVI(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                const int Width, const int Height, const NDVIAnalysis& analysis,
+                std::vector<unsigned char>& output, ThreadPool* pool = 0);
+
+// Render the vegetation pixels of the analysis as a bit packed mask
+VegetationMask renderMask(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                          const int Width, const int Height,
+                          const NDVIAnalysis& analysis, ThreadPool* pool = 0);
+
+// Same, into mask, which keeps its capacity from an earlier frame
+void renderMask(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                const int Width, const int Height, const NDVIAnalysis& analysis,
+                VegetationMask& mask, ThreadPool* pool = 0);
+
+
+// Convert a greyscale (0-255) image to RGB
+// Output will be 3 identical channels plus alpha in 4 byte RGBARGBA format
+template<typename T>
+std::vector<unsigned char> greyscale2RGB(const std::vector<T>& image, const int Width, const int Height)
+{
+  std::vector<unsigned char> output;
+  output.resize(Width * Height * 4); // Output image will by 4x bigger than the input
+
+  for (int dy=0; dy<Height; dy++){
+    for (int dx=0; dx<Width; dx++){
+      output[4 * Width * dy + 4 * dx + 0] = (unsigned char) image[dy * Width + dx];
+      output[4 * Width * dy + 4 * dx + 1] =  (unsigned char) image[dy * Width + dx];
+      output[4 * Width * dy + 4 * dx + 2] =  (unsigned char) image[dy * Width + dx];
+      output[4 * Width * dy + 4 * dx + 3] =  (unsigned char) 255;
+    }
+  }
+  return output;
+}
+
+// Byte images, which is what renderNDVI produces, use the vector expand kernel
+template<>
+std::vector<unsigned char> greyscale2RGB<unsigned char>(const std::vector<unsigned char>& image, const int Width, const int Height);
+
+// Same, into output, which keeps its capacity from an earlier frame
+void greyscale2RGB(const std::vector<unsigned char>& image, const int Width, const int Height,
+                   std::vector<unsigned char>& output);
+
+#endif // ANALYSIS_H
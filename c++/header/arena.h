@@ -0,0 +1,79 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      arena.h
+   Description: Per worker frame arena: pooled lodepng allocations and the frame buffers, reused frame to frame
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <vector>
+#include "analysis.h"
+#include "mask.h"
+
+
+// Heap use of an arena, to show that a series of frames of one size allocates nothing after the first
+struct ArenaStats
+{
+  size_t requests;        // allocations and growing reallocations asked for
+  size_t reused;          // of those, served from a pooled block
+  size_t heapAllocations; // blocks taken from malloc
+  size_t heapBytes;       // bytes taken from malloc
+};
+
+// A pool of the blocks lodepng allocates while decoding and encoding a frame (the zlib output, the IDAT
+// data, the scanlines, the LZ77 hash tables...), together with the analysis buffers of the frame.
+// Freed blocks go back on a free list by size class (four classes per power of two) instead of to the
+// heap, so the next frame of the same size finds every block it needs. One arena per worker thread,
+// made current with useFrameArena; lodepng_malloc, lodepng_realloc and lodepng_free then use it on
+// that thread. A block can be freed on any thread, it goes back to the arena it came from.
+class FrameArena
+{
+public:
+  FrameArena();
+  ~FrameArena(); // gives the pooled blocks back to the heap; every block must have been freed
+
+  // A block of at least size bytes from this arena, 0 if the heap is out of memory
+  void* allocate(size_t size);
+  // Resize a block of any arena, or of none, as realloc does. A block without an arena (ptr 0) comes
+  // from the arena of the calling thread.
+  static void* reallocate(void* ptr, size_t size);
+  // Free a block of any arena, or of none
+  static void release(void* ptr);
+
+  // Give the pooled blocks back to the heap, e.g. before frames of another size
+  void trim();
+
+  ArenaStats stats() const;
+  void resetStats();
+
+  // The buffers of one frame, kept at their capacity for the next one
+  std::vector<unsigned char> png;         // the file
+  std::vector<unsigned char> ir, blue;    // the planes (see loadPNG)
+  NDVIAnalysis analysis;                  // with the engine's scratch
+  std::vector<unsigned char> greyscale;   // renderNDVI
+  VegetationMask mask;                    // renderMask
+  std::vector<unsigned char> grey1;       // mask.toGrey1
+
+private:
+  static const int CLASSES = 240;
+
+  void* freeList[CLASSES]; // free blocks of each size class, linked through their first bytes
+  ArenaStats counts;
+  mutable pthread_mutex_t mutex;
+
+  void put(void* block, size_t sizeClass);
+
+  FrameArena(const FrameArena&);
+  FrameArena& operator=(const FrameArena&);
+};
+
+// Make arena the one lodepng allocates from on the calling thread, 0 for plain malloc
+void useFrameArena(FrameArena* arena);
+
+// The arena of the calling thread, or 0
+FrameArena* frameArena();
+
+#endif // ARENA_H
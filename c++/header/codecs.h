@@ -0,0 +1,79 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      codecs.h
+   Description: The deflate codecs for the PNG image data, plugged into lodepng's custom_inflate/custom_deflate,
+                and the encoder presets trading PNG size for encode time
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef CODECS_H
+#define CODECS_H
+
+#include <string>
+#include <vector>
+#include "lodepng.h"
+
+
+// A raw deflate decoder and encoder for lodepng's custom_inflate and custom_deflate hooks; lodepng still
+// writes and checks the zlib header and the Adler32. A null function leaves lodepng's own in place.
+struct PNGCodec
+{
+  const char* name; // "lodepng", "zlib" (when configure found the system zlib) or "fast"
+  unsigned (*inflate)(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                      const LodePNGDecompressSettings* settings);
+  unsigned (*deflate)(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                      const LodePNGCompressSettings* settings);
+  // One part of a raw deflate stream, as lodepng_deflate_part, for the parallel encoder (paralleldeflate.h)
+  unsigned (*deflatePart)(unsigned char** out, size_t* outsize, const unsigned char* in, size_t start,
+                          size_t end, unsigned final, const LodePNGCompressSettings* settings);
+};
+
+// The codec for every PNG read and written: the configure time default (--with-codec, lodepng unless
+// given) until selectPNGCodec picks another one
+const PNGCodec& pngCodec();
+
+// The codec with the given name, or 0 if it is not built in
+const PNGCodec* pngCodecByName(const char* name);
+
+// Make the named codec the one pngCodec() returns, false if it is not built in
+bool selectPNGCodec(const char* name);
+
+// The names of the built in codecs, comma separated
+std::string pngCodecNames();
+
+// Plug codec into the decoder and encoder settings of state
+void usePNGCodec(const PNGCodec& codec, LodePNGState* state);
+
+// An encoder preset: the deflate and filter settings of lodepng's encoder from "store" (no compression at
+// all) through "fast" to "max". The zlib codec picks the nearest zlib level from the same settings.
+struct PNGLevel
+{
+  const char* name;       // "store", "fast", "default" or "max"
+  unsigned btype;         // 0 stored, 1 fixed Huffman, 2 dynamic Huffman
+  unsigned windowsize;    // LZ77 window, which also bounds the hash chains searched
+  unsigned nicematch;     // stop searching at a match this long
+  unsigned lazymatching;  // look one byte ahead for a longer match
+  LodePNGFilterStrategy filter; // per image (e.g. LFS_TWO, Up) or per row (LFS_MINSUM)
+};
+
+// The preset for every PNG written: "default", lodepng's own settings, until selectPNGLevel picks another
+const PNGLevel& pngLevel();
+
+// The preset with the given name, or 0 if there is none
+const PNGLevel* pngLevelByName(const char* name);
+
+// Make the named preset the one pngLevel() returns, false if there is none
+bool selectPNGLevel(const char* name);
+
+// The names of the presets, comma separated, fastest first
+std::string pngLevelNames();
+
+// Set the encoder settings of state to level
+void usePNGLevel(const PNGLevel& level, LodePNGState* state);
+
+// Decode png with every built in codec and check the pixels are those of lodepng's own decoder, then
+// encode them with every codec and check they decode back the same. Last, inflate corrupted copies of a
+// deflate stream of the pixels with every codec and check each rejects the same ones as lodepng's own
+// inflater. Prints one line per codec and check and returns false on any difference.
+bool checkPNGCodecs(const std::vector<unsigned char>& png);
+
+#endif // CODECS_H
@@ -0,0 +1,21 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      fastinflate.h
+   Description: Table driven deflate decoder for the PNG image data, one of the PNG codecs (see codecs.h)
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef FASTINFLATE_H
+#define FASTINFLATE_H
+
+#include <stddef.h>
+#include "lodepng.h"
+
+
+// Decode the raw deflate stream in[0..insize-1] and append the bytes to the *outsize bytes of *out, which is
+// replaced by a buffer from lodepng_malloc (see arena.h). Returns 0 or the error code lodepng's own
+// inflater gives for the same fault. Has the signature of LodePNGDecompressSettings::custom_inflate, of the
+// settings only expected_size is used, to allocate the output at once.
+unsigned fastInflate(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                     const LodePNGDecompressSettings* settings);
+
+#endif // FASTINFLATE_H
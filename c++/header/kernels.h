@@ -0,0 +1,51 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      kernels.h
+   Description: Per instruction set pixel kernels for the NDVI stages, selected at run time
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// One set of kernels per instruction set. Every kernel gives bit identical results to the scalar code
+// in analysis.cpp, so the choice of kernels never changes the printed metric. The band passes of the
+// engines (analyseNDVI, analyseNDVIHistogram, NDVIAccumulator, renderNDVI and renderMask) use pairs,
+// minMax and pack; the others serve the reference stages.
+struct NDVIKernels
+{
+  const char* name; // "scalar", "sse2", "avx2" or "neon"
+
+  // Pair index ir << 8 | blue of npixels pixels of the IR and blue planes
+  void (*pairs)(const unsigned char* ir, const unsigned char* blue, uint16_t* pair, size_t npixels);
+
+  // Lower *min and raise *max to the smallest and largest of n values, as a compare per value would
+  void (*minMax)(const float* values, size_t n, float* min, float* max);
+
+  // Bit packed mask (see VegetationMask) of n flags that are 0 or 1
+  void (*pack)(const unsigned char* flags, uint64_t* mask, size_t n);
+
+  // NDVI of npixels RGBA pixels (IR in channel 0, blue in channel 2), 0/0 gives 0
+  void (*ndvi)(const unsigned char* rgba, float* ndvi, size_t npixels);
+
+  // (float)(((in - black) / range) * 255) evaluated in double, as scaleImage
+  void (*scale)(const float* in, float* scaled, size_t npixels, double black, double range);
+
+  // Bit packed mask (see VegetationMask) of in >= threshold, as thresholdImage
+  void (*threshold)(const float* in, uint64_t* mask, size_t npixels, int threshold);
+
+  // Expand greyscale bytes to RGBA with three identical channels and opaque alpha
+  void (*expand)(const unsigned char* grey, unsigned char* rgba, size_t npixels);
+};
+
+// The best kernels this CPU supports. Chosen once, by the first call from any thread; the PLANTHEALTH_KERNELS
+// environment variable can name a lower set (e.g. "scalar") to compare against.
+const NDVIKernels& ndviKernels();
+
+// The kernels with the given name, or 0 if they are not built in or not supported by this CPU
+const NDVIKernels* ndviKernelSet(const char* name);
+
+#endif // KERNELS_H
@@ -77,6 +77,12 @@ source files with custom allocators.*/
 #ifndef LODEPNG_NO_COMPILE_ALLOCATORS
 #define LODEPNG_COMPILE_ALLOCATORS
 #endif
+/*SSE2/SSSE3/PCLMUL (x86) and NEON (64-bit ARM) versions of the scanline unfiltering, color conversions and
+CRC32/Adler32 checksums, picked at run time by what the CPU supports. They give the same bytes as the portable
+code, which is used when this is disabled.*/
+#ifndef LODEPNG_NO_COMPILE_SIMD
+#define LODEPNG_COMPILE_SIMD
+#endif
 /*compile the C++ version (you can disable the C++ wrapper here even when compiling for C++)*/
 #ifdef __cplusplus
 #ifndef LODEPNG_NO_COMPILE_CPP
@@ -84,6 +90,16 @@ source files with custom allocators.*/
 #endif
 #endif
 
+#ifndef LODEPNG_COMPILE_ALLOCATORS
+/*The allocators the project defines instead of the default ones. Every buffer lodepng allocates, frees or
+reallocates goes through these, including those passed to and from custom_inflate and custom_deflate.
+The project's lodepng_malloc (arena.cpp) puts a header in front of each buffer, so every buffer lodepng
+returns must be released with lodepng_free, never with free.*/
+void* lodepng_malloc(size_t size);
+void* lodepng_realloc(void* ptr, size_t new_size);
+void lodepng_free(void* ptr);
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+
 #ifdef LODEPNG_COMPILE_PNG
 /*The PNG color types (also used for raw).*/
 typedef enum LodePNGColorType
@@ -101,7 +117,7 @@ Converts PNG data in memory to raw pixel data.
 out: Output parameter. Pointer to buffer that will contain the raw pixel data.
      After decoding, its size is w * h * (bytes per pixel) bytes larger than
      initially. Bytes per pixel depends on colortype and bitdepth.
-     Must be freed after usage with free(*out).
+     Must be freed after usage with lodepng_free(*out).
      Note: for 16-bit per channel colors, uses big endian format like PNG does.
 w: Output parameter. Pointer to width of pixel data.
 h: Output parameter. Pointer to height of pixel data.
@@ -150,7 +166,7 @@ Converts raw pixel data into a PNG image in memory. The colortype and bitdepth
   by the colortype, bitdepth and content of the input pixel data.
   Note: for 16-bit per channel colors, needs big endian format like PNG does.
 out: Output parameter. Pointer to buffer that will contain the PNG image data.
-     Must be freed after usage with free(*out).
+     Must be freed after usage with lodepng_free(*out).
 outsize: Output parameter. Pointer to the size in bytes of the out buffer.
 image: The raw pixel data to encode. The size of this buffer should be
        w * h * (bytes per pixel), bytes per pixel depends on colortype and bitdepth.
@@ -267,6 +283,10 @@ struct LodePNGDecompressSettings
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*size of the inflated data if it is known in advance, else 0 (default: 0). The PNG decoder sets it for the
+  image data, and the inflaters, custom_inflate included, then allocate their output once at that size*/
+  size_t expected_size;
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -509,6 +529,16 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
                          unsigned w, unsigned h);
 
+/*
+Converts a raw buffer to separate 8-bit planes (structure of arrays) instead of interleaved pixels.
+Plane k receives channel channels[k] (0 = R, 1 = G, 2 = B, 3 = A) of the RGBA8 color of every pixel,
+e.g. channels {0, 2} gives one plane of red and one of blue values. Each planes[k] must have w * h bytes.
+Return value is LodePNG error code
+*/
+unsigned lodepng_convert_planes(unsigned char** planes, const unsigned* channels, unsigned numplanes,
+                                const unsigned char* in, const LodePNGColorMode* mode_in,
+                                unsigned w, unsigned h);
+
 #ifdef LODEPNG_COMPILE_DECODER
 /*
 Settings for the decoder. This contains settings for the PNG and the Zlib
@@ -530,6 +560,14 @@ typedef struct LodePNGDecoderSettings
 } LodePNGDecoderSettings;
 
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings);
+
+/*
+Profile for PNGs from a trusted local source, such as frames written by our own capture pipeline: skips the
+CRC of every chunk and the Adler32 of the zlib data (ignore_crc and zlibsettings.ignore_adler32). Corrupted
+data is then no longer reported as such, but decoding stays safe: every length, Huffman code and distance is
+still checked against the bounds of the data. Don't use it for files from elsewhere.
+*/
+void lodepng_decoder_settings_trusted(LodePNGDecoderSettings* settings);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -537,7 +575,13 @@ void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings);
 typedef enum LodePNGFilterStrategy
 {
   /*every filter at zero*/
-  LFS_ZERO,
+  LFS_ZERO = 0,
+  /*every filter at 1, 2, 3 or 4 (Sub, Up, Average, Paeth): one filter for the whole image, which
+  costs no more than LFS_ZERO, but e.g. Up compresses photos much better*/
+  LFS_ONE = 1,
+  LFS_TWO = 2,
+  LFS_THREE = 3,
+  LFS_FOUR = 4,
   /*Use filter that gives minumum sum, as described in the official PNG filter heuristic.*/
   LFS_MINSUM,
   /*Use the filter type that gives smallest Shannon entropy for this scanline. Depending
@@ -649,6 +693,74 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize);
 
+/*
+Same as lodepng_decode, but decodes into the caller's buffer out of outsize bytes instead of allocating one,
+e.g. the same buffer for every image of a series. The pixels are written into out once, also when they are
+converted to state->info_raw. Gives error 94 when the image does not fit in outsize bytes; lodepng_inspect
+and lodepng_get_raw_size give the size needed beforehand.
+*/
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize);
+
+/*
+Same as lodepng_decode, but decodes to numplanes separate 8-bit planes as lodepng_convert_planes does.
+The planes are read straight from the unfiltered scanlines, so no interleaved RGBA image is made.
+Each planes[k] is allocated with w * h bytes; free them with lodepng_free (free with the default allocators).
+state->info_raw and state->decoder.color_convert are not used.
+*/
+unsigned lodepng_decode_planes(unsigned char** planes, const unsigned* channels, unsigned numplanes,
+                               unsigned* w, unsigned* h, LodePNGState* state,
+                               const unsigned char* in, size_t insize);
+
+/*Same as lodepng_decode_planes, but into the caller's numplanes buffers of planesize bytes each, error 94 when
+w * h is more than planesize*/
+unsigned lodepng_decode_planes_into(unsigned char* const* planes, size_t planesize,
+                                    const unsigned* channels, unsigned numplanes,
+                                    unsigned* w, unsigned* h, LodePNGState* state,
+                                    const unsigned char* in, size_t insize);
+
+/*
+Called by lodepng_decode_rows for each row y, top to bottom, with rows[k] the w bytes of that row in plane k.
+Return 0 to continue, or an error code to stop decoding, which lodepng_decode_rows then returns.
+*/
+typedef unsigned (*LodePNGRowCallback)(void* user, unsigned y, unsigned w, const unsigned char* const* rows);
+
+/*
+Same as lodepng_decode_planes, but streams: the IDAT data is inflated through a 64KB sliding window and every
+scanline is unfiltered against the previous one and handed to callback as soon as it is complete, so apart
+from the PNG itself only a few rows are held in memory. Adam7 interlaced images cannot be streamed; those
+are decoded whole with lodepng_decode_planes and then passed to callback row by row.
+*/
+unsigned lodepng_decode_rows(const unsigned* channels, unsigned numplanes,
+                             unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user);
+
+/*
+Called by lodepng_inflate_scanlines for each scanline y, top to bottom: the filter type byte followed by the
+still filtered bytes of the row, size bytes in all. Return 0 to continue, or an error code to stop.
+*/
+typedef unsigned (*LodePNGScanlineCallback)(void* user, unsigned y, const unsigned char* scanline, size_t size);
+
+/*
+The first half of lodepng_decode_rows: reads the chunks into state->info_png and inflates the IDAT data,
+handing every scanline to callback as soon as it is complete, without unfiltering it. Together with
+lodepng_unfilter_scanline this lets the inflating and the unfiltering run on different threads. Adam7
+interlaced images give error 95.
+*/
+unsigned lodepng_inflate_scanlines(unsigned* w, unsigned* h, LodePNGState* state,
+                                   const unsigned char* in, size_t insize,
+                                   LodePNGScanlineCallback callback, void* user);
+
+/*
+Unfilter one scanline of a w pixels wide image in the given color mode, as passed to a LodePNGScanlineCallback,
+into recon. precon is the previous unfiltered row, or NULL for the first one. recon and precon hold
+(w * bpp + 7) / 8 bytes.
+*/
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                   unsigned w, const LodePNGColorMode* color);
+
 /*
 Read the PNG header, but not the actual data. This returns only the information
 that is in the header chunk of the PNG, such as width, height and color type. The
@@ -661,7 +773,8 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h,
 
 
 #ifdef LODEPNG_COMPILE_ENCODER
-/*This function allocates the out buffer with standard malloc and stores the size in *outsize.*/
+/*This function allocates the out buffer with lodepng_malloc and stores the size in *outsize.
+Free it with lodepng_free.*/
 unsigned lodepng_encode(unsigned char** out, size_t* outsize,
                         const unsigned char* image, unsigned w, unsigned h,
                         LodePNGState* state);
@@ -744,8 +857,15 @@ buffer. It cannot be used to create gzip files however, and it only supports the
 part of zlib that is required for PNG, it does not support dictionaries.
 */
 
+/*Adler32 of the bytes data[0..len-1], the checksum at the end of a zlib stream*/
+unsigned lodepng_adler32(const unsigned char* data, size_t len);
+
+/*The Adler32 of two buffers one after the other, from that of each and the length of the second*/
+unsigned lodepng_adler32_combine(unsigned adler1, unsigned adler2, size_t len2);
+
 #ifdef LODEPNG_COMPILE_DECODER
-/*Inflate a buffer. Inflate is the decompression step of deflate. Out buffer must be freed after use.*/
+/*Inflate a buffer. Inflate is the decompression step of deflate. Out buffer must be freed after use
+with lodepng_free.*/
 unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGDecompressSettings* settings);
@@ -754,7 +874,7 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
 Decompresses Zlib data. Reallocates the out buffer and appends the data. The
 data must be according to the zlib specification.
 Either, *out must be NULL and *outsize must be 0, or, *out must be a valid
-buffer and *outsize its size in bytes. out must be freed by user after usage.
+buffer and *outsize its size in bytes. out must be freed by user after usage, with lodepng_free.
 */
 unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize,
                                  const unsigned char* in, size_t insize,
@@ -767,7 +887,7 @@ Compresses data with Zlib. Reallocates the out buffer and appends the data.
 Zlib adds a small header and trailer around the deflate data.
 The data is output in the format of the zlib specification.
 Either, *out must be NULL and *outsize must be 0, or, *out must be a valid
-buffer and *outsize its size in bytes. out must be freed by user after usage.
+buffer and *outsize its size in bytes. out must be freed by user after usage, with lodepng_free.
 */
 unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize,
                                const unsigned char* in, size_t insize,
@@ -780,18 +900,28 @@ public interface only for tests, it's used internally by lodepng_deflate.
 unsigned lodepng_huffman_code_lengths(unsigned* lengths, const unsigned* frequencies,
                                       size_t numcodes, unsigned maxbitlen);
 
-/*Compress a buffer with deflate. See RFC 1951. Out buffer must be freed after use.*/
+/*Compress a buffer with deflate. See RFC 1951. Out buffer must be freed after use with lodepng_free.*/
 unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings);
 
+/*
+Deflate in[start, end) as one part of a deflate stream over in[0, n): LZ77 matches can reach back into the window
+before start, which an earlier part holds. Unless final, the part ends with an empty stored block instead of a
+last block, so it stops on a byte boundary and the next part can follow it as is. The parts of in, each made on
+any thread, then give the same stream as lodepng_deflate apart from the block boundaries. Appends to *out like
+lodepng_deflate; custom_deflate is not used.
+*/
+unsigned lodepng_deflate_part(unsigned char** out, size_t* outsize, const unsigned char* in,
+                              size_t start, size_t end, unsigned final, const LodePNGCompressSettings* settings);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
 #ifdef LODEPNG_COMPILE_DISK
 /*
 Load a file from disk into buffer. The function allocates the out buffer, and
-after usage you should free it.
+after usage you should free it with lodepng_free.
 out: output parameter, contains pointer to loaded buffer.
 outsize: output parameter, size of the allocated out buffer
 filename: the path to the file to load
@@ -832,6 +962,19 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
                 State& state,
                 const std::vector<unsigned char>& in);
+//Same as lodepng_decode_planes, the planes are appended to the numplanes vectors of planes.
+unsigned decode_planes(std::vector<unsigned char>* planes, const unsigned* channels, unsigned numplanes,
+                       unsigned& w, unsigned& h, State& state,
+                       const unsigned char* in, size_t insize);
+//Same as decode and decode_planes, but out and the planes are resized to hold exactly the decoded pixels
+//instead of appended to, and the pixels are decoded straight into them. Resizing keeps the capacity, so
+//vectors reused for a series of images of the same size are not reallocated or cleared between images.
+unsigned decode_into(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
+                     State& state,
+                     const unsigned char* in, size_t insize);
+unsigned decode_planes_into(std::vector<unsigned char>* planes, const unsigned* channels, unsigned numplanes,
+                            unsigned& w, unsigned& h, State& state,
+                            const unsigned char* in, size_t insize);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -1019,9 +1162,10 @@ The following features are _not_ supported:
 2. C and C++ version
 --------------------
 
-The C version uses buffers allocated with alloc that you need to free()
-yourself. You need to use init and cleanup functions for each struct whenever
-using a struct from the C version to avoid exploits and memory leaks.
+The C version uses buffers allocated with lodepng_malloc that you need to
+release with lodepng_free() yourself (not free(), see lodepng_malloc above).
+You need to use init and cleanup functions for each struct whenever using a
+struct from the C version to avoid exploits and memory leaks.
 
 The C++ version has extra functions with std::vectors in the interface and the
 lodepng::State class which is a LodePNGState with constructor and destructor.
@@ -1096,7 +1240,8 @@ LodePNGDecoderSettings decoder
 ------------------------------
 
 The settings can be used to ignore the errors created by invalid CRC and Adler32
-chunks, and to disable the decoding of tEXt chunks.
+chunks, and to disable the decoding of tEXt chunks. lodepng_decoder_settings_trusted
+sets both checksums to be ignored at once, for images from a source you control.
 
 There's also a setting color_convert, true by default. If false, no conversion
 is done, the resulting data will be as it was in the PNG (after decompression)
@@ -1548,7 +1693,7 @@ int main(int argc, char *argv[])
 
   / * use image here * /
 
-  free(image);
+  lodepng_free(image);
   return 0;
 }
 
@@ -0,0 +1,59 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      mask.h
+   Description: Bit packed vegetation mask, one bit per pixel
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef MASK_H
+#define MASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+// Vegetation mask of a Width x Height image.
+// Pixel i (row major) is bit i % 64 of word i / 64, so a 12 MP frame needs 1.5 MB instead of the 48 MB
+// of a std::vector<int>. Bits past the last pixel are always zero, so counts and word operations can
+// work on whole words.
+class VegetationMask
+{
+public:
+  VegetationMask();
+  VegetationMask(const int Width, const int Height);
+
+  // Resize to Width x Height with every pixel cleared
+  void resize(const int Width, const int Height);
+
+  int width() const { return Width; }
+  int height() const { return Height; }
+  size_t size() const { return (size_t) Width * Height; }
+
+  bool get(const size_t i) const { return (bits[i >> 6] >> (i & 63)) & 1; }
+  void set(const size_t i) { bits[i >> 6] |= (uint64_t) 1 << (i & 63); }
+  void clear(const size_t i) { bits[i >> 6] &= ~((uint64_t) 1 << (i & 63)); }
+
+  // Number of vegetation pixels
+  size_t count() const;
+
+  // Combine with another mask of the same size, a word at a time
+  VegetationMask& operator&=(const VegetationMask& other);
+  VegetationMask& operator|=(const VegetationMask& other);
+  void invert();
+
+  // Raw words for kernels that produce or consume the mask directly
+  uint64_t* words() { return bits.empty() ? 0 : &bits[0]; }
+  const uint64_t* words() const { return bits.empty() ? 0 : &bits[0]; }
+  size_t wordCount() const { return bits.size(); }
+
+  // Pixels packed 8 per byte, most significant bit first and without padding between rows, which is
+  // the raw layout lodepng expects for a 1-bit greyscale (LCT_GREY, bitdepth 1) image
+  std::vector<unsigned char> toGrey1() const;
+  void toGrey1(std::vector<unsigned char>& output) const; // into output, keeping its capacity
+
+private:
+  int Width, Height;
+  std::vector<uint64_t> bits;
+};
+
+#endif // MASK_H
@@ -0,0 +1,38 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      paralleldeflate.h
+   Description: PNG image data deflated in bands on the worker threads and stitched into one zlib stream
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef PARALLELDEFLATE_H
+#define PARALLELDEFLATE_H
+
+#include <stddef.h>
+#include "codecs.h"
+#include "lodepng.h"
+#include "threadpool.h"
+
+class FrameArena;
+
+
+// The settings of a parallel encode, passed to parallelZlibCompress as lodepng's custom_context. They must
+// outlive the encode.
+struct ParallelDeflate
+{
+  ThreadPool* pool;      // the workers, the calling thread among them
+  const PNGCodec* codec; // deflatePart of the codec, lodepng's when it has none
+  FrameArena* arena;     // the workers allocate from it, 0 for malloc
+};
+
+// lodepng custom_zlib: the filtered scanlines are split into bands of at least 256KB, a few per worker, and
+// every band is deflated on its own with the window before it as dictionary (see lodepng_deflate_part). The
+// parts follow one another in band order after the zlib header, and the Adler32s of the bands are combined
+// into the one of the whole. Any decoder reads the result; it is a little larger than a serial encode, by
+// the byte aligned band ends and the Huffman tables started afresh.
+unsigned parallelZlibCompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                              const LodePNGCompressSettings* settings);
+
+// Make the encoder of state use parallelZlibCompress with parallel
+void useParallelDeflate(const ParallelDeflate& parallel, LodePNGState* state);
+
+#endif // PARALLELDEFLATE_H
@@ -0,0 +1,23 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      pipeline.h
+   Description: PNG decode split over two threads, one inflating the scanlines and one unfiltering them
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include "lodepng.h"
+
+
+// lodepng_decode_rows with the inflate on a thread of its own: it hands the filtered scanlines through a
+// ring of about 1MB to the calling thread, which unfilters them, converts them to the planes and calls
+// callback, so the callback's work (e.g. the NDVI histogram) overlaps the inflate. Same arguments, results
+// and errors as lodepng_decode_rows, which it falls back to for Adam7 interlaced images or when no thread
+// can be started.
+unsigned decodeRowsPipelined(const unsigned* channels, unsigned numplanes, unsigned& w, unsigned& h,
+                             LodePNGState& state, const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user);
+
+#endif // PIPELINE_H
@@ -0,0 +1,58 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      threadpool.h
+   Description: Fixed size pool of POSIX threads that runs indexed tasks, e.g. one per row band
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <vector>
+
+
+// A pool of threads workers, where the calling thread is worker 0 and threads - 1 are started here.
+// run() hands out the task indices [0, count) to the workers in any order and returns once all of them
+// are done, so results that must not depend on the thread count should be kept per task index and
+// merged by the caller in index order.
+class ThreadPool
+{
+public:
+  typedef void (*Task)(void* arg, int index, int worker);
+
+  explicit ThreadPool(int threads);
+  ~ThreadPool();
+
+  // Number of workers, including the calling thread
+  int size() const { return nthreads; }
+
+  void run(Task task, void* arg, int count);
+
+  // Number of online processors, at least 1
+  static int processors();
+
+private:
+  struct Worker { ThreadPool* pool; int id; };
+  static void* workerMain(void* worker);
+  void work(int worker);
+
+  int nthreads;
+  std::vector<pthread_t> threads;
+  std::vector<Worker> workers;
+  pthread_mutex_t mutex;
+  pthread_cond_t start, done;
+
+  Task task;
+  void* arg;
+  int count, next, active;
+  unsigned generation;
+  bool stopping;
+
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+};
+
+// Run task over [0, count) on the pool, or on the calling thread as worker 0 when there is no pool
+void runTasks(ThreadPool* pool, ThreadPool::Task task, void* arg, int count);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,47 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      timings.h
+   Description: Monotonic wall clock timings of the stages of a run, reported with -t/--timings
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+#ifndef TIMINGS_H
+#define TIMINGS_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+
+// Stages are timed one after another: start() begins a stage and stop() ends it with the number of bytes
+// and pixels it processed. Code that can be timed takes a StageTimings* that is 0 when timings are off.
+class StageTimings
+{
+public:
+  StageTimings();
+
+  void start(const char* stage);
+  void stop(size_t bytes, size_t pixels);
+
+  // One line per stage and a total since construction on out, as
+  //   timing stage=<name> seconds=<s> bytes=<n> pixels=<n> MB/s=<rate> MP/s=<rate>
+  // with MB and MP as 10^6 bytes and pixels. Stages over the 65536 (IR, blue) pairs rather than the
+  // pixels report 0 pixels.
+  void report(FILE* out) const;
+
+  // Seconds on the monotonic clock
+  static double now();
+
+private:
+  struct Stage
+  {
+    const char* name;
+    double seconds;
+    size_t bytes, pixels;
+  };
+
+  std::vector<Stage> stages;
+  const char* current;
+  double started, created;
+};
+
+#endif // TIMINGS_H
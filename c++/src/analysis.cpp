@@ -0,0 +1,663 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      analysis.cpp
+   Description: NDVI analysis stages used by planthealth
+   Language:    C++
+   Usage:
+                The reference stages (calculateNDVI, minMax, scaleImage, otsu_threshold, thresholdImage and
+                sumVegetationIndex) each walk the whole frame and allocate a full size image.
+                analyseNDVI produces the same results from a single streaming pass over the IR and blue
+                planes decoded straight from the PNG plus a compact per (IR, blue) pair state, see analysis.h
+                The band passes build the pair indices, min/max and mask words with the kernels of kernels.h
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "analysis.h"
+#include "kernels.h"
+#include "threadpool.h"
+#include "timings.h"
+
+
+// NDVI lookup table
+// irpixel and bluepixel are both 8-bit so there are only 65536 possible NDVI values. They are computed
+// once at start up with the same float arithmetic calculateNDVI used, so a lookup is bit identical to
+// the division it replaces. 0/0 (a black pixel) has no NDVI and is defined as 0 instead of NaN.
+static float ndvi_table[65536];
+
+static void buildNDVITable(float* table)
+{
+  for (int ir=0; ir<256; ir++){
+    for (int blue=0; blue<256; blue++){
+      float irpixel = (float) ir;
+      float bluepixel = (float) blue;
+      float numerator = (irpixel - bluepixel);
+      float denominator = (irpixel + bluepixel);
+      table[(ir << 8) | blue] = denominator > 0 ? (numerator / denominator) : 0.0f;
+    }
+  }
+}
+
+// The table is filled during static initialisation, before main() and any worker can read it
+static struct NDVITableInit { NDVITableInit() { buildNDVITable(ndvi_table); } } ndvi_table_init;
+
+const float* ndviTable()
+{
+  return ndvi_table;
+}
+
+
+// Scaled 0-255 bin of every (IR, blue) pair for the NDVI range [min, max], same arithmetic as scaleImage
+void scaleTable(const float min, const float max, std::vector<unsigned char>& pairBin)
+{
+  double data_black = min;
+  double data_white = max;
+  double range = data_white - data_black;
+  pairBin.resize(65536);
+  for (int pair=0; pair<65536; pair++){
+    float scaled = range > 0.0 ? (float) (((ndvi_table[pair] - data_black)/range) * 255) : 0.0f;
+    if(scaled < 0) // pairs outside [min, max] do not occur in the image, keep them in range anyway
+      scaled = 0;
+    if(scaled > 255)
+      scaled = 255;
+    pairBin[pair] = (unsigned char) scaled;
+  }
+}
+
+
+// Otsu Method for Automatic Thresholding
+// from: http://www.labbookpages.co.uk/software/imgProc/otsuThreshold.html
+int otsu_threshold(const std::vector<float>& scaled, int Width, int Height)
+{
+  // Calculate histogram
+  std::vector<uint64_t> histogram;
+  if(histogram.size() != 256) // check it is the right size
+    histogram.resize(256);
+  for(int i=0; i<256; i++) // Initialise Histogram bins to zero
+    histogram[i] = 0;
+  for (int dy=0; dy<Height; dy++){ // Now loop through the image and
+    for (int dx=0; dx<Width; dx++){
+      int index = scaled[dy * Width + dx]; // Find the bin
+      if (index > 255 ) // make sure we are not out of bounds
+	printf("index too big: %d", index);
+      if (index < 0 )
+	printf("index too small: %d", index);
+      histogram[ index ]++; // Increment the bin frequency
+    }
+  }
+
+  // Total number of pixels
+  uint64_t total = scaled.size();
+
+  return otsuFromHistogram(histogram, total);
+}
+
+
+// Otsu Threshold from a 256 bin histogram of total pixels
+int otsuFromHistogram(const std::vector<uint64_t>& histogram, uint64_t total)
+{
+  // Now calculate the Otsu Threshold
+  float sum = 0.0;
+  for (int t=0 ; t<256 ; t++) sum += t * histogram[t];
+
+  float sumB = 0.0;
+  uint64_t wB = 0;
+  uint64_t wF = 0;
+
+  float varMax = 0.0;
+  int threshold = 0;
+
+  for (int t=0 ; t<256 ; t++) {
+    wB += histogram[t];               // Weight Background
+    if (wB == 0) continue;
+
+    wF = total - wB;                 // Weight Foreground
+    if (wF == 0) break;
+
+    sumB += (float) (t * histogram[t]);
+
+    float mB = sumB / wB;            // Mean Background
+    float mF = (sum - sumB) / wF;    // Mean Foreground
+
+    // Calculate Between Class Variance
+    float varBetween = (float)wB * (float)wF * (mB - mF) * (mB - mF);
+
+    // Check if new maximum found
+    if (varBetween > varMax) {
+      varMax = varBetween;
+      threshold = t;
+    }
+  }
+  return threshold;
+}
+
+
+// Calculate the NDVI image from the original IRGB image
+std::vector<float> calculateNDVI(const std::vector<unsigned char>& image, const int Width, const int Height)
+{
+  std::vector<float> ndvi_raw;
+  ndvi_raw.resize(Width*Height);
+  // Do the NDVI calculation with the best kernel for this CPU
+  if(!ndvi_raw.empty())
+    ndviKernels().ndvi(&image[0], &ndvi_raw[0], ndvi_raw.size());
+  return ndvi_raw;
+}
+
+
+// Calculate the minimum and maximum pixel values in an image
+void minMax(const std::vector<float>& image, const int Width, const int Height, float& min, float& max)
+{
+  // Calculate the min and max values:
+  for (int dy=0; dy<Height; dy++){
+    for (int dx=0; dx<Width; dx++){
+      if(image[dy * Width + dx] < min)
+	min = image[dy * Width + dx];
+      if(max < image[dy * Width + dx])
+	max = image[dy * Width + dx];
+    }
+  }
+
+}
+
+
+// Scale a float image into the normal 0-255 greyscale range
+std::vector<float> scaleImage(const std::vector<float>& image, const int Width, const int Height, const float min, const float max)
+{
+  double data_black = min;
+  double data_white = max;
+  double range = data_white - data_black;
+
+  std::vector<float> scaled;
+  scaled.resize(Width*Height);
+  if(!scaled.empty())
+    ndviKernels().scale(&image[0], &scaled[0], scaled.size(), data_black, range);
+  return scaled;
+}
+
+
+// Threshold a greyscale image into a bit packed vegetation mask
+VegetationMask thresholdImage(const std::vector<float>& image, const int Width, const int Height, const int threshold)
+{
+  VegetationMask bitmap(Width, Height);
+  if(bitmap.size() != 0)
+    ndviKernels().threshold(&image[0], bitmap.words(), bitmap.size(), threshold);
+  return bitmap;
+}
+
+
+// Convert a greyscale byte image to RGBA with the vector expand kernel
+template<>
+std::vector<unsigned char> greyscale2RGB<unsigned char>(const std::vector<unsigned char>& image, const int Width, const int Height)
+{
+  std::vector<unsigned char> output;
+  greyscale2RGB(image, Width, Height, output);
+  return output;
+}
+
+void greyscale2RGB(const std::vector<unsigned char>& image, const int Width, const int Height,
+                   std::vector<unsigned char>& output)
+{
+  output.resize((size_t) Width * Height * 4);
+  if(!output.empty())
+    ndviKernels().expand(&image[0], &output[0], (size_t) Width * Height);
+}
+
+
+// Reduce the NDVI into a single relative metric by summing over all vegetation pixels
+// Only the set bits of the mask are visited, in increasing pixel order, so the float sum is the same as
+// a scan of every pixel.
+float sumVegetationIndex(const std::vector<float>&ndvi_raw, const VegetationMask& bitmap)
+{
+  float sumVegIndex = 0.0;
+  const uint64_t* words = bitmap.words();
+  for (size_t w=0; w<bitmap.wordCount(); w++){
+    uint64_t word = words[w];
+    while(word){
+#ifdef __GNUC__
+      int b = __builtin_ctzll(word);
+#else
+      int b = 0;
+      while(!((word >> b) & 1))
+        b++;
+#endif
+      sumVegIndex += ndvi_raw[64 * w + b];
+      word &= word - 1;
+    }
+  }
+  return sumVegIndex;
+}
+
+
+// Stage timings, when they are wanted
+static void startStage(StageTimings* timings, const char* stage)
+{
+  if(timings)
+    timings->start(stage);
+}
+
+static void stopStage(StageTimings* timings, const size_t bytes, const size_t pixels)
+{
+  if(timings)
+    timings->stop(bytes, pixels);
+}
+
+// Scale the pairs for [min, max], find the Otsu threshold from the pair counts and mark the vegetation pairs
+static void thresholdPairs(NDVIAnalysis& result, const uint64_t npixels, StageTimings* timings)
+{
+  const uint64_t* pairCount = &result.pairCount[0];
+
+  // Scale every pair into the 0-255 range and build the Otsu histogram from the pair counts
+  startStage(timings, "scale");
+  scaleTable(result.min, result.max, result.pairBin);
+  stopStage(timings, 65536 * sizeof(float), 0);
+
+  startStage(timings, "otsu");
+  result.binCount.assign(256, 0);
+  for (int pair=0; pair<65536; pair++)
+    result.binCount[result.pairBin[pair]] += pairCount[pair];
+  result.threshold = otsuFromHistogram(result.binCount, npixels);
+  stopStage(timings, 65536 * sizeof(uint64_t), 0);
+
+  // The bin is the truncated scaled value so bin >= threshold is the same test thresholdImage makes
+  startStage(timings, "threshold");
+  result.pairVegetation.assign(65536, 0);
+  for (int pair=0; pair<65536; pair++)
+    if(pairCount[pair] != 0 && result.pairBin[pair] >= result.threshold)
+      result.pairVegetation[pair] = 1;
+  stopStage(timings, 65536 * sizeof(uint64_t), 0);
+}
+
+
+// Row bands
+// The engine splits the frame into bands of whole rows of about BAND_PIXELS pixels. The band layout
+// depends only on the image size, never on the number of threads, and every floating point partial is
+// kept per band and merged in band order, so the results are bit for bit the same for any thread count.
+static const int BAND_PIXELS = 65536;
+
+// The band passes work on chunks of CHUNK_PIXELS pixels: a kernel builds the pair indices of a chunk
+// into a buffer on the stack, then the table lookups run over the buffer.
+static const int CHUNK_PIXELS = 4096;
+
+static size_t chunkPixels(const size_t i, const size_t last)
+{
+  return last - i < (size_t) CHUNK_PIXELS ? last - i : CHUNK_PIXELS;
+}
+
+struct BandJob
+{
+  const NDVIKernels* kernels;    // chosen on the calling thread, before the bands go to the pool
+  const unsigned char* ir;       // IR plane
+  const unsigned char* blue;     // blue plane
+  int Width, Height;
+  int rowsPerBand, bands;
+  NDVIAnalysis* scratch;                           // per worker histograms (merged by addition) and per
+                                                   // band partials, 0 for the render passes
+  const unsigned char* vegetation;                 // per pair vegetation flags for the sum pass
+  unsigned char* output;                           // renderNDVI output
+  const unsigned char* pairBin;                    // per pair scaled bin for renderNDVI
+};
+
+static void initBands(BandJob& job, const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                      const int Width, const int Height, ThreadPool* pool, NDVIAnalysis* scratch = 0)
+{
+  job.kernels = &ndviKernels();
+  job.ir = ir.empty() ? 0 : &ir[0];
+  job.blue = blue.empty() ? 0 : &blue[0];
+  job.Width = Width;
+  job.Height = Height;
+  job.rowsPerBand = Width > 0 && Width < BAND_PIXELS ? (BAND_PIXELS + Width - 1) / Width : 1;
+  job.bands = (Height + job.rowsPerBand - 1) / job.rowsPerBand;
+  job.scratch = scratch;
+  if(scratch){
+    // resize and assign keep the capacity, and the histograms, of an earlier frame
+    scratch->workerCount.resize(pool ? pool->size() : 1);
+    scratch->workerTotal.resize(scratch->workerCount.size());
+    scratch->workerPixels.assign(scratch->workerCount.size(), 0);
+    scratch->workerUsed.assign(scratch->workerCount.size(), 0);
+    scratch->bandMin.assign(job.bands, 0.0f);
+    scratch->bandMax.assign(job.bands, 0.0f);
+    scratch->bandSum.assign(job.bands, 0.0);
+  }
+  job.vegetation = 0;
+  job.output = 0;
+  job.pairBin = 0;
+}
+
+// First and one past the last pixel of a band, in size_t as frames can pass 2^31 pixels
+static void bandPixels(const BandJob& job, const int band, size_t& first, size_t& last)
+{
+  int firstRow = band * job.rowsPerBand;
+  int lastRow = firstRow + job.rowsPerBand < job.Height ? firstRow + job.rowsPerBand : job.Height;
+  first = (size_t) firstRow * job.Width;
+  last = (size_t) lastRow * job.Width;
+}
+
+// Pixels a 32-bit histogram takes before it is folded into a 64-bit one: no count can overflow before then
+static const uint64_t FOLD_PIXELS = 0xFFFFFFFFu;
+
+// Add count into the 64-bit total, which starts empty, and clear count
+static void foldCounts(std::vector<uint64_t>& total, std::vector<unsigned>& count)
+{
+  total.resize(65536, 0);
+  for (int pair=0; pair<65536; pair++){
+    total[pair] += count[pair];
+    count[pair] = 0;
+  }
+}
+
+// Histogram of one worker for a band of pixels pixels, cleared on its first band of the frame
+static unsigned* workerHistogram(BandJob& job, const int worker, const size_t pixels)
+{
+  NDVIAnalysis& scratch = *job.scratch;
+  std::vector<unsigned>& count = scratch.workerCount[worker];
+  if(!scratch.workerUsed[worker]){
+    count.assign(65536, 0);
+    scratch.workerTotal[worker].clear();
+    scratch.workerUsed[worker] = 1;
+  }
+  if(scratch.workerPixels[worker] + pixels > FOLD_PIXELS){
+    foldCounts(scratch.workerTotal[worker], count);
+    scratch.workerPixels[worker] = 0;
+  }
+  scratch.workerPixels[worker] += pixels;
+  return &count[0];
+}
+
+// Add up the worker histograms into result.pairCount
+static void mergeHistograms(NDVIAnalysis& result)
+{
+  result.pairCount.assign(65536, 0);
+  uint64_t* pairCount = &result.pairCount[0];
+  for (size_t w=0; w<result.workerCount.size(); w++){
+    if(!result.workerUsed[w])
+      continue;
+    const unsigned* count = &result.workerCount[w][0];
+    for (int pair=0; pair<65536; pair++)
+      pairCount[pair] += count[pair];
+    if(!result.workerTotal[w].empty()){
+      const uint64_t* total = &result.workerTotal[w][0];
+      for (int pair=0; pair<65536; pair++)
+        pairCount[pair] += total[pair];
+    }
+  }
+}
+
+// Streaming pass of one band: NDVI, min/max and the (IR, blue) histogram
+static void ndviBand(void* arg, int band, int worker)
+{
+  BandJob& job = *(BandJob*) arg;
+  size_t first, last;
+  bandPixels(job, band, first, last);
+  unsigned* pairCount = workerHistogram(job, worker, last - first);
+
+  uint16_t pairs[CHUNK_PIXELS];
+  float values[CHUNK_PIXELS];
+  float min = 0.0, max = 0.0;
+  for (size_t i=first; i<last; i+=CHUNK_PIXELS){
+    size_t n = chunkPixels(i, last);
+    job.kernels->pairs(job.ir + i, job.blue + i, pairs, n);
+    for (size_t j=0; j<n; j++){
+      values[j] = ndvi_table[pairs[j]];
+      pairCount[pairs[j]]++;
+    }
+    job.kernels->minMax(values, n, &min, &max);
+  }
+  job.scratch->bandMin[band] = min;
+  job.scratch->bandMax[band] = max;
+}
+
+// Vegetation sum of one band
+static void sumBand(void* arg, int band, int)
+{
+  BandJob& job = *(BandJob*) arg;
+  size_t first, last;
+  bandPixels(job, band, first, last);
+
+  const unsigned char* vegetation = job.vegetation;
+  uint16_t pairs[CHUNK_PIXELS];
+  double sumVegIndex = 0.0;
+  for (size_t i=first; i<last; i+=CHUNK_PIXELS){
+    size_t n = chunkPixels(i, last);
+    job.kernels->pairs(job.ir + i, job.blue + i, pairs, n);
+    for (size_t j=0; j<n; j++)
+      if(vegetation[pairs[j]])
+        sumVegIndex += ndvi_table[pairs[j]];
+  }
+  job.scratch->bandSum[band] = sumVegIndex;
+}
+
+// Integer-only pass of one band for the histogram domain engine
+static void countBand(void* arg, int band, int worker)
+{
+  BandJob& job = *(BandJob*) arg;
+  size_t first, last;
+  bandPixels(job, band, first, last);
+  unsigned* pairCount = workerHistogram(job, worker, last - first);
+  uint16_t pairs[CHUNK_PIXELS];
+  for (size_t i=first; i<last; i+=CHUNK_PIXELS){
+    size_t n = chunkPixels(i, last);
+    job.kernels->pairs(job.ir + i, job.blue + i, pairs, n);
+    for (size_t j=0; j<n; j++)
+      pairCount[pairs[j]]++;
+  }
+}
+
+
+// Fused analysis: NDVI, min/max and the pair histogram in one pass, threshold from the histogram,
+// then the vegetation sum over the 8-bit input. Both passes run over row bands on the pool.
+void analyseNDVI(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                 const int Width, const int Height, NDVIAnalysis& result, ThreadPool* pool, StageTimings* timings)
+{
+  const size_t npixels = (size_t) Width * Height;
+  BandJob job;
+  initBands(job, ir, blue, Width, Height, pool, &result);
+
+  // Streaming pass: NDVI, min/max and the (IR, blue) histogram
+  startStage(timings, "ndvi_minmax");
+  runTasks(pool, ndviBand, &job, job.bands);
+  mergeHistograms(result);
+  float min = 0.0, max = 0.0;
+  for (int band=0; band<job.bands; band++){
+    if(result.bandMin[band] < min)
+      min = result.bandMin[band];
+    if(max < result.bandMax[band])
+      max = result.bandMax[band];
+  }
+  result.min = min;
+  result.max = max;
+  stopStage(timings, 2 * npixels, npixels);
+
+  thresholdPairs(result, npixels, timings);
+
+  // Vegetation sum: a double per band, added up in band order
+  startStage(timings, "sum");
+  job.vegetation = &result.pairVegetation[0];
+  runTasks(pool, sumBand, &job, job.bands);
+  double sumVegIndex = 0.0;
+  for (int band=0; band<job.bands; band++)
+    sumVegIndex += result.bandSum[band];
+  result.totalVegIndex = (float) sumVegIndex;
+  stopStage(timings, 2 * npixels, npixels);
+}
+
+
+// min/max, threshold and vegetation sum of npixels pixels from result.pairCount alone
+static void analysePairs(NDVIAnalysis& result, const uint64_t npixels, StageTimings* timings)
+{
+  const uint64_t* pairCount = &result.pairCount[0];
+
+  // min/max over the pairs that occur, starting from 0 as minMax does
+  startStage(timings, "minmax");
+  float min = 0.0, max = 0.0;
+  for (int pair=0; pair<65536; pair++){
+    if(pairCount[pair] == 0)
+      continue;
+    if(ndvi_table[pair] < min)
+      min = ndvi_table[pair];
+    if(max < ndvi_table[pair])
+      max = ndvi_table[pair];
+  }
+  result.min = min;
+  result.max = max;
+  stopStage(timings, 65536 * sizeof(uint64_t), 0);
+
+  thresholdPairs(result, npixels, timings);
+
+  // Each vegetation pair contributes count * NDVI, summed in double in pair order
+  startStage(timings, "sum");
+  double sumVegIndex = 0.0;
+  for (int pair=0; pair<65536; pair++)
+    if(result.pairVegetation[pair])
+      sumVegIndex += (double) pairCount[pair] * ndvi_table[pair];
+  result.totalVegIndex = (float) sumVegIndex;
+  stopStage(timings, 65536 * sizeof(uint64_t), 0);
+}
+
+
+// Histogram domain analysis: one integer-only pass counts the (IR, blue) pairs, then min/max, the
+// threshold and the vegetation sum are all computed over the 65536 pairs
+void analyseNDVIHistogram(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                          const int Width, const int Height, NDVIAnalysis& result, ThreadPool* pool,
+                          StageTimings* timings)
+{
+  // Streaming pass: one increment per pixel
+  startStage(timings, "histogram");
+  BandJob job;
+  initBands(job, ir, blue, Width, Height, pool, &result);
+  runTasks(pool, countBand, &job, job.bands);
+  mergeHistograms(result);
+  stopStage(timings, 2 * (size_t) Width * Height, (size_t) Width * Height);
+  analysePairs(result, (uint64_t) Width * Height, timings);
+}
+
+
+NDVIAccumulator::NDVIAccumulator()
+  : kernels(&ndviKernels()), pairCount(65536, 0), rowCount(65536, 0), rowPixels(0), npixels(0)
+{
+}
+
+
+void NDVIAccumulator::addRow(const unsigned char* ir, const unsigned char* blue, const int Width)
+{
+  if(rowPixels + Width > FOLD_PIXELS){
+    foldCounts(pairCount, rowCount);
+    rowPixels = 0;
+  }
+  unsigned* count = &rowCount[0];
+  uint16_t pairs[CHUNK_PIXELS];
+  for (size_t i=0; i<(size_t) Width; i+=CHUNK_PIXELS){
+    size_t n = chunkPixels(i, Width);
+    kernels->pairs(ir + i, blue + i, pairs, n);
+    for (size_t j=0; j<n; j++)
+      count[pairs[j]]++;
+  }
+  rowPixels += Width;
+  npixels += Width;
+}
+
+
+void NDVIAccumulator::finish(NDVIAnalysis& result, StageTimings* timings) const
+{
+  result.pairCount = pairCount;
+  for (int pair=0; pair<65536; pair++)
+    result.pairCount[pair] += rowCount[pair];
+  analysePairs(result, npixels, timings);
+}
+
+
+// Scaled NDVI of one band
+static void renderBand(void* arg, int band, int)
+{
+  BandJob& job = *(BandJob*) arg;
+  size_t first, last;
+  bandPixels(job, band, first, last);
+  const unsigned char* pairBin = job.pairBin;
+  uint16_t pairs[CHUNK_PIXELS];
+  for (size_t i=first; i<last; i+=CHUNK_PIXELS){
+    size_t n = chunkPixels(i, last);
+    job.kernels->pairs(job.ir + i, job.blue + i, pairs, n);
+    unsigned char* output = job.output + i;
+    for (size_t j=0; j<n; j++)
+      output[j] = pairBin[pairs[j]];
+  }
+}
+
+
+// Greyscale rendering of the analysis: the scaled NDVI
+std::vector<unsigned char> renderNDVI(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                                      const int Width, const int Height,
+                                      const NDVIAnalysis& analysis, ThreadPool* pool)
+{
+  std::vector<unsigned char> output;
+  renderNDVI(ir, blue, Width, Height, analysis, output, pool);
+  return output;
+}
+
+void renderNDVI(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                const int Width, const int Height, const NDVIAnalysis& analysis,
+                std::vector<unsigned char>& output, ThreadPool* pool)
+{
+  output.resize((size_t) Width * Height);
+  BandJob job;
+  initBands(job, ir, blue, Width, Height, pool);
+  job.output = output.empty() ? 0 : &output[0];
+  job.pairBin = &analysis.pairBin[0];
+  runTasks(pool, renderBand, &job, job.bands);
+}
+
+
+// Mask words of one band of MASK_BAND_WORDS words, packed a chunk of CHUNK_PIXELS flags at a time
+static const int MASK_BAND_WORDS = BAND_PIXELS / 64;
+
+struct MaskJob
+{
+  const NDVIKernels* kernels;
+  const unsigned char* ir;
+  const unsigned char* blue;
+  const unsigned char* vegetation;
+  VegetationMask* mask;
+};
+
+static void maskBand(void* arg, int band, int)
+{
+  MaskJob& job = *(MaskJob*) arg;
+  const unsigned char* vegetation = job.vegetation;
+  uint64_t* words = job.mask->words();
+  size_t first = (size_t) band * BAND_PIXELS;
+  size_t last = first + BAND_PIXELS < job.mask->size() ? first + BAND_PIXELS : job.mask->size();
+  uint16_t pairs[CHUNK_PIXELS];
+  unsigned char flags[CHUNK_PIXELS];
+  for (size_t i=first; i<last; i+=CHUNK_PIXELS){
+    size_t n = chunkPixels(i, last);
+    job.kernels->pairs(job.ir + i, job.blue + i, pairs, n);
+    for (size_t j=0; j<n; j++)
+      flags[j] = vegetation[pairs[j]];
+    job.kernels->pack(flags, words + i / 64, n);
+  }
+}
+
+
+// Vegetation mask of the analysis
+VegetationMask renderMask(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                          const int Width, const int Height,
+                          const NDVIAnalysis& analysis, ThreadPool* pool)
+{
+  VegetationMask mask;
+  renderMask(ir, blue, Width, Height, analysis, mask, pool);
+  return mask;
+}
+
+void renderMask(const std::vector<unsigned char>& ir, const std::vector<unsigned char>& blue,
+                const int Width, const int Height, const NDVIAnalysis& analysis,
+                VegetationMask& mask, ThreadPool* pool)
+{
+  mask.resize(Width, Height);
+  MaskJob job;
+  job.kernels = &ndviKernels();
+  job.ir = ir.empty() ? 0 : &ir[0];
+  job.blue = blue.empty() ? 0 : &blue[0];
+  job.vegetation = &analysis.pairVegetation[0];
+  job.mask = &mask;
+  runTasks(pool, maskBand, &job, (int) ((mask.wordCount() + MASK_BAND_WORDS - 1) / MASK_BAND_WORDS));
+}
@@ -0,0 +1,229 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      arena.cpp
+   Description: Per worker frame arena: pooled lodepng allocations and the frame buffers, reused frame to frame
+   Language:    C++
+   Usage:
+                lodepng is built with LODEPNG_NO_COMPILE_ALLOCATORS (see Makefile.am), and the allocators
+                it then needs are defined here: they take blocks from the arena of the calling thread, or
+                from malloc when it has none. Every block starts with a small header naming its arena and
+                size class, so lodepng_free and lodepng_realloc work on any thread and on any block.
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "lodepng.h"
+
+
+// Header in front of every block, 16 bytes on 64-bit targets so the data keeps malloc's alignment
+struct Block
+{
+  FrameArena* arena; // 0 for a block from plain malloc
+  size_t sizeClass;  // size class, or the size of a plain block
+};
+
+static Block* header(void* ptr) { return (Block*) ptr - 1; }
+static void* data(Block* block) { return block + 1; }
+
+// Bytes a block of the size class holds: 64, then four classes per power of two (80, 96, 112, 128, 160...)
+static size_t classCapacity(size_t c) { return (size_t) (4 + c % 4) << (c / 4 + 4); }
+
+// The smallest size class that holds size bytes
+static size_t sizeClass(size_t size)
+{
+  if(size <= 64)
+    return 0;
+  size_t top = size - 1;
+  int shift = 0;
+  while((top >> shift) >= 8)
+    shift++;
+  // top >> shift is 4..7, so size <= (mantissa + 1) << shift
+  return (size_t) (shift - 4) * 4 + ((top >> shift) - 3);
+}
+
+
+static void* plainAllocate(size_t size)
+{
+  Block* block = (Block*) malloc(sizeof(Block) + size);
+  if(!block)
+    return 0;
+  block->arena = 0;
+  block->sizeClass = size;
+  return data(block);
+}
+
+
+FrameArena::FrameArena()
+{
+  pthread_mutex_init(&mutex, 0);
+  for (int c=0; c<CLASSES; c++)
+    freeList[c] = 0;
+  resetStats();
+}
+
+
+FrameArena::~FrameArena()
+{
+  trim();
+  pthread_mutex_destroy(&mutex);
+}
+
+
+void* FrameArena::allocate(size_t size)
+{
+  if(size > ((size_t) -1) / 4)
+    return 0;
+  size_t c = sizeClass(size);
+
+  pthread_mutex_lock(&mutex);
+  counts.requests++;
+  void* ptr = freeList[c];
+  if(ptr){
+    freeList[c] = *(void**) ptr;
+    counts.reused++;
+  }
+  else{
+    counts.heapAllocations++;
+    counts.heapBytes += sizeof(Block) + classCapacity(c);
+  }
+  pthread_mutex_unlock(&mutex);
+  if(ptr)
+    return ptr;
+
+  Block* block = (Block*) malloc(sizeof(Block) + classCapacity(c));
+  if(!block)
+    return 0;
+  block->arena = this;
+  block->sizeClass = c;
+  return data(block);
+}
+
+
+void* FrameArena::reallocate(void* ptr, size_t size)
+{
+  if(!ptr){
+    FrameArena* arena = frameArena();
+    return arena ? arena->allocate(size) : plainAllocate(size);
+  }
+
+  Block* block = header(ptr);
+  FrameArena* arena = block->arena;
+  if(!arena){
+    Block* moved = (Block*) realloc(block, sizeof(Block) + size);
+    if(!moved)
+      return 0;
+    moved->sizeClass = size;
+    return data(moved);
+  }
+
+  // lodepng grows its vectors by doubling, so most of the time the block already holds the new size
+  size_t capacity = classCapacity(block->sizeClass);
+  if(size <= capacity){
+    pthread_mutex_lock(&arena->mutex);
+    arena->counts.requests++;
+    arena->counts.reused++;
+    pthread_mutex_unlock(&arena->mutex);
+    return ptr;
+  }
+  void* grown = arena->allocate(size);
+  if(!grown)
+    return 0;
+  memcpy(grown, ptr, capacity);
+  arena->put(ptr, block->sizeClass);
+  return grown;
+}
+
+
+void FrameArena::release(void* ptr)
+{
+  if(!ptr)
+    return;
+  Block* block = header(ptr);
+  if(block->arena)
+    block->arena->put(ptr, block->sizeClass);
+  else
+    free(block);
+}
+
+
+void FrameArena::put(void* ptr, size_t c)
+{
+  pthread_mutex_lock(&mutex);
+  *(void**) ptr = freeList[c];
+  freeList[c] = ptr;
+  pthread_mutex_unlock(&mutex);
+}
+
+
+void FrameArena::trim()
+{
+  pthread_mutex_lock(&mutex);
+  for (int c=0; c<CLASSES; c++){
+    while(freeList[c]){
+      void* ptr = freeList[c];
+      freeList[c] = *(void**) ptr;
+      free(header(ptr));
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+
+ArenaStats FrameArena::stats() const
+{
+  pthread_mutex_lock(&mutex);
+  ArenaStats copy = counts;
+  pthread_mutex_unlock(&mutex);
+  return copy;
+}
+
+
+void FrameArena::resetStats()
+{
+  pthread_mutex_lock(&mutex);
+  counts.requests = 0;
+  counts.reused = 0;
+  counts.heapAllocations = 0;
+  counts.heapBytes = 0;
+  pthread_mutex_unlock(&mutex);
+}
+
+
+// The arena of each thread
+static pthread_key_t arenaKey;
+static pthread_once_t arenaKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createArenaKey()
+{
+  pthread_key_create(&arenaKey, 0);
+}
+
+void useFrameArena(FrameArena* arena)
+{
+  pthread_once(&arenaKeyOnce, createArenaKey);
+  pthread_setspecific(arenaKey, arena);
+}
+
+FrameArena* frameArena()
+{
+  pthread_once(&arenaKeyOnce, createArenaKey);
+  return (FrameArena*) pthread_getspecific(arenaKey);
+}
+
+
+// lodepng's allocators
+void* lodepng_malloc(size_t size)
+{
+  return FrameArena::reallocate(0, size);
+}
+
+void* lodepng_realloc(void* ptr, size_t new_size)
+{
+  return FrameArena::reallocate(ptr, new_size);
+}
+
+void lodepng_free(void* ptr)
+{
+  FrameArena::release(ptr);
+}
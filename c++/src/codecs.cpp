@@ -0,0 +1,396 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      codecs.cpp
+   Description: The deflate codecs for the PNG image data, plugged into lodepng's custom_inflate/custom_deflate,
+                and the encoder presets trading PNG size for encode time
+   Language:    C++
+   Usage:
+                lodepng's own codec needs no library. configure adds the system zlib when it finds it
+                (HAVE_ZLIB, --without-zlib leaves it out) and --with-codec=name picks the default. The fast
+                codec is the table driven inflater of fastinflate.cpp with lodepng's encoder. All of them
+                only replace the raw deflate part, so the zlib header, the Adler32 and the ignore_adler32
+                setting are handled by lodepng whichever codec is used; the parallel encoder (paralleldeflate.h)
+                writes them itself around the parts the codec deflates. The presets only set lodepng's
+                encoder settings; the zlib codec turns them into a zlib level.
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "codecs.h"
+#include "fastinflate.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef PLANTHEALTH_CODEC
+#define PLANTHEALTH_CODEC "lodepng"
+#endif
+
+
+#ifdef HAVE_ZLIB
+
+// zlib takes at most 4GB per call
+static uInt zlibChunk(size_t n) { return n > (1u << 30) ? (1u << 30) : (uInt) n; }
+
+// zlib's own state comes from lodepng's allocators too, so it is pooled with the frame (see arena.h)
+static voidpf zlibAlloc(voidpf, uInt items, uInt size) { return lodepng_malloc((size_t) items * size); }
+static void zlibFree(voidpf, voidpf ptr) { lodepng_free(ptr); }
+
+// Raw inflate with zlib, appending to *out as lodepng's inflater does. A truncated stream gives lodepng's
+// error 23, any other fault in the data error 11.
+static unsigned zlibInflate(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                            const LodePNGDecompressSettings* settings)
+{
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  z.zalloc = zlibAlloc;
+  z.zfree = zlibFree;
+  if(inflateInit2(&z, -15) != Z_OK)
+    return 83;
+
+  // The size the decoder expects, with a byte to spare so zlib can see the end of the stream without
+  // another pass, else a guess
+  size_t size = *outsize;
+  size_t capacity = size + (settings->expected_size ? settings->expected_size + 1 : insize < 16384 ? 65536 : insize * 4);
+  unsigned char* data = (unsigned char*) lodepng_malloc(capacity);
+  const unsigned char* next = in;
+  size_t left = insize;
+  int ret = data ? Z_OK : Z_MEM_ERROR;
+  if(data && size)
+    memcpy(data, *out, size);
+  while (ret == Z_OK){
+    if(size == capacity){
+      unsigned char* grown = (unsigned char*) lodepng_realloc(data, capacity * 2);
+      if(!grown){
+        ret = Z_MEM_ERROR;
+        break;
+      }
+      data = grown;
+      capacity *= 2;
+    }
+    if(z.avail_in == 0 && left){
+      z.next_in = (Bytef*) next;
+      z.avail_in = zlibChunk(left);
+      next += z.avail_in;
+      left -= z.avail_in;
+    }
+    z.next_out = data + size;
+    z.avail_out = zlibChunk(capacity - size);
+    ret = inflate(&z, Z_NO_FLUSH);
+    size = z.next_out - data;
+  }
+  inflateEnd(&z);
+
+  if(ret != Z_STREAM_END){
+    lodepng_free(data);
+    return ret == Z_MEM_ERROR ? 83 : ret == Z_BUF_ERROR ? 23 : 11;
+  }
+  lodepng_free(*out);
+  *out = data;
+  *outsize = size;
+  return 0;
+}
+
+// The zlib level nearest to lodepng's settings (see PNGLevel): stored, greedy, lodepng's default or the
+// largest window
+static int zlibLevel(const LodePNGCompressSettings* settings)
+{
+  if(settings->btype == 0)
+    return 0;
+  if(!settings->lazymatching)
+    return 1;
+  if(settings->windowsize >= 32768)
+    return 9;
+  return Z_DEFAULT_COMPRESSION;
+}
+
+// Raw deflate of in[start, end) with zlib at the level nearest to the settings, and fixed Huffman codes for
+// btype 1, as lodepng_deflate_part: the window before start is the dictionary, and a part that is not final
+// ends with Z_SYNC_FLUSH's empty stored block
+static unsigned zlibDeflatePart(unsigned char** out, size_t* outsize, const unsigned char* in, size_t start,
+                                size_t end, unsigned final, const LodePNGCompressSettings* settings)
+{
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  z.zalloc = zlibAlloc;
+  z.zfree = zlibFree;
+  int strategy = settings->btype == 1 ? Z_FIXED : Z_DEFAULT_STRATEGY;
+  if(deflateInit2(&z, zlibLevel(settings), Z_DEFLATED, -15, 8, strategy) != Z_OK)
+    return 83;
+  size_t dictionary = start < 32768 ? start : 32768;
+  if(dictionary && deflateSetDictionary(&z, in + start - dictionary, (uInt) dictionary) != Z_OK){
+    deflateEnd(&z);
+    return 83;
+  }
+
+  // the flush marker is 5 bytes on top of the bound
+  size_t size = *outsize, capacity = size + deflateBound(&z, (uLong) (end - start)) + 5;
+  unsigned char* data = (unsigned char*) lodepng_realloc(*out, capacity);
+  const unsigned char* next = in + start;
+  size_t left = end - start;
+  int finish = final ? Z_FINISH : Z_SYNC_FLUSH;
+  int ret = data ? Z_OK : Z_MEM_ERROR;
+  if(data)
+    *out = data;
+  while (ret == Z_OK){
+    if(size == capacity){
+      unsigned char* grown = (unsigned char*) lodepng_realloc(data, capacity * 2);
+      if(!grown){
+        ret = Z_MEM_ERROR;
+        break;
+      }
+      *out = data = grown;
+      capacity *= 2;
+    }
+    if(z.avail_in == 0 && left){
+      z.next_in = (Bytef*) next;
+      z.avail_in = zlibChunk(left);
+      next += z.avail_in;
+      left -= z.avail_in;
+    }
+    z.next_out = data + size;
+    z.avail_out = zlibChunk(capacity - size);
+    int flush = left ? Z_NO_FLUSH : finish;
+    ret = deflate(&z, flush);
+    size = z.next_out - data;
+    // a sync flush is complete once it leaves output space over
+    if(flush == Z_SYNC_FLUSH && ret == Z_OK && z.avail_out != 0)
+      ret = Z_STREAM_END;
+  }
+  deflateEnd(&z);
+
+  *outsize = size;
+  return ret == Z_STREAM_END ? 0 : 83;
+}
+
+// Raw deflate of all of in with zlib, see zlibDeflatePart
+static unsigned zlibDeflate(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                            const LodePNGCompressSettings* settings)
+{
+  return zlibDeflatePart(out, outsize, in, 0, insize, 1, settings);
+}
+
+#endif // HAVE_ZLIB
+
+
+static const PNGCodec codecs[] = {
+  { "lodepng", 0, 0, 0 },
+#ifdef HAVE_ZLIB
+  { "zlib", zlibInflate, zlibDeflate, zlibDeflatePart },
+#endif
+  { "fast", fastInflate, 0, 0 }
+};
+static const size_t numCodecs = sizeof(codecs) / sizeof(codecs[0]);
+
+static const PNGCodec* selected = 0;
+
+
+const PNGCodec* pngCodecByName(const char* name)
+{
+  for (size_t i=0; i<numCodecs; i++)
+    if(strcmp(name, codecs[i].name) == 0)
+      return &codecs[i];
+  return 0;
+}
+
+const PNGCodec& pngCodec()
+{
+  if(!selected)
+    selected = pngCodecByName(PLANTHEALTH_CODEC);
+  if(!selected)
+    selected = &codecs[0];
+  return *selected;
+}
+
+bool selectPNGCodec(const char* name)
+{
+  const PNGCodec* codec = pngCodecByName(name);
+  if(codec)
+    selected = codec;
+  return codec != 0;
+}
+
+std::string pngCodecNames()
+{
+  std::string names;
+  for (size_t i=0; i<numCodecs; i++){
+    if(i)
+      names += ",";
+    names += codecs[i].name;
+  }
+  return names;
+}
+
+void usePNGCodec(const PNGCodec& codec, LodePNGState* state)
+{
+  state->decoder.zlibsettings.custom_inflate = codec.inflate;
+  state->encoder.zlibsettings.custom_deflate = codec.deflate;
+}
+
+
+static const PNGLevel levels[] = {
+  { "store", 0, 2048, 128, 0, LFS_ZERO },
+  { "fast", 1, 256, 32, 0, LFS_TWO },
+  { "default", 2, 2048, 128, 1, LFS_MINSUM },
+  { "max", 2, 32768, 258, 1, LFS_ENTROPY }
+};
+static const size_t numLevels = sizeof(levels) / sizeof(levels[0]);
+
+static const PNGLevel* selectedLevel = 0;
+
+
+const PNGLevel* pngLevelByName(const char* name)
+{
+  for (size_t i=0; i<numLevels; i++)
+    if(strcmp(name, levels[i].name) == 0)
+      return &levels[i];
+  return 0;
+}
+
+const PNGLevel& pngLevel()
+{
+  if(!selectedLevel)
+    selectedLevel = pngLevelByName("default");
+  return *selectedLevel;
+}
+
+bool selectPNGLevel(const char* name)
+{
+  const PNGLevel* level = pngLevelByName(name);
+  if(level)
+    selectedLevel = level;
+  return level != 0;
+}
+
+std::string pngLevelNames()
+{
+  std::string names;
+  for (size_t i=0; i<numLevels; i++){
+    if(i)
+      names += ",";
+    names += levels[i].name;
+  }
+  return names;
+}
+
+void usePNGLevel(const PNGLevel& level, LodePNGState* state)
+{
+  LodePNGCompressSettings& zlibsettings = state->encoder.zlibsettings;
+  zlibsettings.btype = level.btype;
+  zlibsettings.use_lz77 = 1;
+  zlibsettings.windowsize = level.windowsize;
+  zlibsettings.nicematch = level.nicematch;
+  zlibsettings.lazymatching = level.lazymatching;
+  state->encoder.filter_strategy = level.filter;
+}
+
+
+// RGBA pixels of png decoded with codec
+static unsigned decodeWith(const PNGCodec& codec, const std::vector<unsigned char>& png,
+                           std::vector<unsigned char>& image, unsigned& w, unsigned& h)
+{
+  lodepng::State state;
+  usePNGCodec(codec, &state);
+  return lodepng::decode(image, w, h, state, png);
+}
+
+// Raw inflate of in with codec, lodepng's own inflater for a null inflate. The output is only kept on success.
+static unsigned inflateWith(const PNGCodec& codec, const std::vector<unsigned char>& in,
+                            std::vector<unsigned char>& data)
+{
+  LodePNGDecompressSettings settings;
+  lodepng_decompress_settings_init(&settings);
+  unsigned char* out = 0;
+  size_t outsize = 0;
+  unsigned error = codec.inflate ? codec.inflate(&out, &outsize, &in[0], in.size(), &settings)
+                                 : lodepng_inflate(&out, &outsize, &in[0], in.size(), &settings);
+  data.assign(out, out + (error ? 0 : outsize));
+  lodepng_free(out);
+  return error;
+}
+
+// Corrupted copies of a deflate stream of (a part of) image, one to three bits flipped per copy, every
+// other copy in the block header where the Huffman code lengths are. Every codec has to reject the same
+// copies as lodepng's own inflater and decode the others to the same bytes. Returns false on a difference.
+static const int CORRUPT_STREAMS = 2000;
+
+static bool checkCorruptStreams(const std::vector<unsigned char>& image)
+{
+  LodePNGCompressSettings settings;
+  lodepng_compress_settings_init(&settings);
+  unsigned char* deflated = 0;
+  size_t deflatedsize = 0;
+  unsigned error = lodepng_deflate(&deflated, &deflatedsize, &image[0], image.size() < 65536 ? image.size() : 65536,
+                                   &settings);
+  std::vector<unsigned char> stream(deflated, deflated + (error ? 0 : deflatedsize));
+  lodepng_free(deflated);
+  if(stream.empty()){
+    printf("codec check: deflate error %u: %s\n", error, lodepng_error_text(error));
+    return false;
+  }
+
+  std::vector<int> differ(numCodecs, 0);
+  int rejected = 0;
+  unsigned seed = 12345;
+  for (int c=0; c<CORRUPT_STREAMS; c++){
+    std::vector<unsigned char> corrupt = stream;
+    size_t span = c % 2 && stream.size() > 96 ? 96 : stream.size();
+    for (int flip=0; flip<=c%3; flip++){
+      seed = seed * 1103515245u + 12345u; // the same copies on every run
+      corrupt[(seed >> 8) % span] ^= (unsigned char) (1 << ((seed >> 28) % 8));
+    }
+
+    std::vector<unsigned char> reference;
+    unsigned referenceError = inflateWith(codecs[0], corrupt, reference);
+    if(referenceError)
+      rejected++;
+    for (size_t i=1; i<numCodecs; i++){
+      std::vector<unsigned char> data;
+      unsigned codecError = inflateWith(codecs[i], corrupt, data);
+      if((codecError != 0) != (referenceError != 0) || data != reference)
+        differ[i]++;
+    }
+  }
+
+  bool same = true;
+  for (size_t i=1; i<numCodecs; i++){
+    printf("codec %-8s corrupt streams %s (%d of %d rejected by lodepng, %d differ)\n", codecs[i].name,
+           differ[i] ? "DIFFERENT" : "identical", rejected, CORRUPT_STREAMS, differ[i]);
+    same = same && !differ[i];
+  }
+  return same;
+}
+
+bool checkPNGCodecs(const std::vector<unsigned char>& png)
+{
+  std::vector<unsigned char> reference;
+  unsigned w = 0, h = 0;
+  unsigned error = decodeWith(codecs[0], png, reference, w, h);
+  if(error){
+    printf("codec check: decoder error %u: %s\n", error, lodepng_error_text(error));
+    return false;
+  }
+
+  bool same = true;
+  for (size_t i=0; i<numCodecs; i++){
+    std::vector<unsigned char> image, encoded, decoded;
+    unsigned dw = 0, dh = 0, ew = 0, eh = 0;
+    unsigned derror = decodeWith(codecs[i], png, image, dw, dh);
+    bool decodes = !derror && dw == w && dh == h && image == reference;
+
+    lodepng::State state;
+    usePNGCodec(codecs[i], &state);
+    unsigned eerror = lodepng::encode(encoded, reference, w, h, state);
+    if(!eerror)
+      eerror = decodeWith(codecs[0], encoded, decoded, ew, eh);
+    bool encodes = !eerror && ew == w && eh == h && decoded == reference;
+
+    printf("codec %-8s decode %s  encode %s (%lu bytes)\n", codecs[i].name,
+           derror ? lodepng_error_text(derror) : decodes ? "identical" : "DIFFERENT",
+           eerror ? lodepng_error_text(eerror) : encodes ? "identical" : "DIFFERENT", (unsigned long) encoded.size());
+    same = same && decodes && encodes;
+  }
+  return checkCorruptStreams(reference) && same;
+}
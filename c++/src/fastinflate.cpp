@@ -0,0 +1,433 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      fastinflate.cpp
+   Description: Table driven deflate decoder for the PNG image data, one of the PNG codecs (see codecs.h)
+   Language:    C++
+   Usage:
+                fastInflate() goes in lodepng's custom_inflate hook; lodepng still checks the zlib header
+                and the Adler32. A Huffman code is decoded with one lookup in a table indexed by the next 11
+                (literal/length) or 8 (distance) bits of input, and a second one in a small subtable for the
+                rare longer codes. The entry also holds the base and the number of extra bits of a length or
+                distance. The input goes through a 64-bit bit buffer refilled with one 8 byte load per symbol,
+                enough for a length code, a distance code and both their extra bits. The output keeps room for
+                a longest match after its end, so matches are copied 8 bytes at a time without end checks.
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "fastinflate.h"
+
+
+namespace {
+
+// A table entry: bits 0-3 the code length (in a subtable the bits after the primary index), bits 4-7 the
+// extra bits of a length or distance (of a subtable pointer its index bits), bits 8-10 the kind and bits
+// 16-31 the literal, base length, base distance or subtable offset
+enum Kind { LITERAL = 0, MATCH = 1, END = 2, SUBTABLE = 3, INVALID = 4 };
+
+inline uint32_t entry(unsigned kind, unsigned value, unsigned extra) { return (value << 16) | (kind << 8) | (extra << 4); }
+inline unsigned entryLength(uint32_t e) { return e & 15; }
+inline unsigned entryExtra(uint32_t e) { return (e >> 4) & 15; }
+inline unsigned entryKind(uint32_t e) { return (e >> 8) & 7; }
+inline unsigned entryValue(uint32_t e) { return e >> 16; }
+
+const unsigned LITLEN_BITS = 11;
+const unsigned DIST_BITS = 8;
+const unsigned CODELENGTH_BITS = 7;
+// The primary table and at most one subtable of up to 2^(15 - bits) entries per symbol
+const unsigned LITLEN_TABLE = (1 << LITLEN_BITS) + 288 * (1 << (15 - LITLEN_BITS));
+const unsigned DIST_TABLE = (1 << DIST_BITS) + 32 * (1 << (15 - DIST_BITS));
+
+// Room kept after the output for a longest match copied in 8 byte steps
+const size_t SLACK = 258 + 8;
+
+const unsigned short LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                         67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const unsigned char LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                         4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const unsigned short DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+                                       769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const unsigned char DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+                                       9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const unsigned char CODELENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+uint32_t litlenSymbol(unsigned s)
+{
+  if(s < 256)
+    return entry(LITERAL, s, 0);
+  if(s == 256)
+    return entry(END, 0, 0);
+  if(s < 286)
+    return entry(MATCH, LENGTH_BASE[s - 257], LENGTH_EXTRA[s - 257]);
+  return entry(INVALID, 0, 0);
+}
+
+uint32_t distSymbol(unsigned s)
+{
+  return s < 30 ? entry(MATCH, DIST_BASE[s], DIST_EXTRA[s]) : entry(INVALID, 0, 0);
+}
+
+uint32_t codeLengthSymbol(unsigned s)
+{
+  return entry(LITERAL, s, 0);
+}
+
+
+// Fill table, 2^bits entries followed by the subtables, for the code lengths[0..num-1] (0 for an unused
+// symbol). Returns false if the lengths oversubscribe the code or leave it incomplete, as lodepng does with
+// error 55, except for a code of fewer than two symbols (e.g. the distance code of a block without matches)
+// whose gaps are left INVALID.
+bool buildTable(uint32_t* table, unsigned bits, const unsigned char* lengths, unsigned num,
+                uint32_t (*symbol)(unsigned))
+{
+  unsigned count[16], next[16];
+  unsigned short reversed[320];
+  unsigned char subbits[1 << LITLEN_BITS];
+  const unsigned size = 1u << bits, mask = size - 1;
+  int left = 1;
+
+  memset(count, 0, sizeof(count));
+  for (unsigned s=0; s<num; s++)
+    count[lengths[s]]++;
+  for (unsigned len=1; len<16; len++){
+    left = (left << 1) - (int) count[len];
+    if(left < 0)
+      return false;
+  }
+  if(left > 0 && num - count[0] >= 2)
+    return false;
+  next[1] = 0;
+  for (unsigned len=1; len<15; len++)
+    next[len + 1] = (next[len] + count[len]) << 1;
+
+  // the canonical codes, bit reversed since deflate sends them first bit first
+  memset(subbits, 0, size);
+  for (unsigned s=0; s<num; s++){
+    unsigned len = lengths[s];
+    if(!len)
+      continue;
+    unsigned code = next[len]++, rev = 0;
+    for (unsigned i=0; i<len; i++)
+      rev |= ((code >> i) & 1) << (len - 1 - i);
+    reversed[s] = (unsigned short) rev;
+    if(len > bits && len - bits > subbits[rev & mask])
+      subbits[rev & mask] = (unsigned char) (len - bits);
+  }
+
+  unsigned offset = size;
+  for (unsigned i=0; i<size; i++){
+    table[i] = entry(INVALID, 0, 0);
+    if(subbits[i]){
+      table[i] = entry(SUBTABLE, offset, subbits[i]);
+      for (unsigned j=0; j<(1u << subbits[i]); j++)
+        table[offset + j] = entry(INVALID, 0, 0);
+      offset += 1u << subbits[i];
+    }
+  }
+
+  for (unsigned s=0; s<num; s++){
+    unsigned len = lengths[s];
+    if(!len)
+      continue;
+    if(len <= bits){
+      for (unsigned i=reversed[s]; i<size; i+=1u << len)
+        table[i] = symbol(s) | len;
+    }
+    else{
+      uint32_t sub = table[reversed[s] & mask];
+      for (unsigned i=reversed[s] >> bits; i<(1u << entryExtra(sub)); i+=1u << (len - bits))
+        table[entryValue(sub) + i] = symbol(s) | (len - bits);
+    }
+  }
+  return true;
+}
+
+
+inline uint64_t load64(const unsigned char* p)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+#else
+  uint64_t v = 0;
+  for (unsigned i=0; i<8; i++)
+    v |= (uint64_t) p[i] << (8 * i);
+  return v;
+#endif
+}
+
+// The input, lowest bit first, through a 64-bit buffer
+struct BitReader
+{
+  const unsigned char* in;
+  size_t size;
+  size_t pos;       // the next byte to load into the buffer
+  uint64_t buffer;  // the next count bits
+  unsigned count;
+
+  // At least 56 bits in the buffer, zeros past the end of the input
+  void refill()
+  {
+    if(pos + 8 <= size){
+      buffer |= load64(in + pos) << count;
+      pos += (63 - count) >> 3;
+      count |= 56;
+    }
+    else{
+      for (; count<=56; count+=8, pos++)
+        if(pos < size)
+          buffer |= (uint64_t) in[pos] << count;
+    }
+  }
+
+  unsigned peek(unsigned n) const { return (unsigned) buffer & ((1u << n) - 1); }
+  void skip(unsigned n) { buffer >>= n; count -= n; }
+
+  // Whether more bits were taken than the input has
+  bool overrun() const { return pos > size && (pos - size) * 8 > count; }
+};
+
+struct Output
+{
+  unsigned char* data;
+  size_t size;
+  size_t capacity;
+
+  // Room for n more bytes and the SLACK after them
+  bool reserve(size_t n)
+  {
+    if(size + n + SLACK <= capacity)
+      return true;
+    size_t grown = capacity * 2 > size + n + SLACK ? capacity * 2 : size + n + SLACK;
+    unsigned char* moved = (unsigned char*) lodepng_realloc(data, grown);
+    if(!moved)
+      return false;
+    data = moved;
+    capacity = grown;
+    return true;
+  }
+};
+
+
+// The symbols of one block with Huffman codes up to its end code. Back references reach to begin.
+unsigned inflateCodes(BitReader& br, Output& out, size_t begin, const uint32_t* litlen, const uint32_t* dist)
+{
+  for (;;){
+    if(!out.reserve(0))
+      return 83;
+    br.refill();
+    if(br.overrun())
+      return 51;
+
+    uint32_t e = litlen[br.peek(LITLEN_BITS)];
+    if(entryKind(e) == SUBTABLE){
+      br.skip(LITLEN_BITS);
+      e = litlen[entryValue(e) + br.peek(entryExtra(e))];
+    }
+    br.skip(entryLength(e));
+    if(entryKind(e) == LITERAL){
+      out.data[out.size++] = (unsigned char) entryValue(e);
+      continue;
+    }
+    if(entryKind(e) == END)
+      return br.overrun() ? 51 : 0;
+    if(entryKind(e) != MATCH)
+      return 11;
+    size_t length = entryValue(e) + br.peek(entryExtra(e));
+    br.skip(entryExtra(e));
+
+    e = dist[br.peek(DIST_BITS)];
+    if(entryKind(e) == SUBTABLE){
+      br.skip(DIST_BITS);
+      e = dist[entryValue(e) + br.peek(entryExtra(e))];
+    }
+    br.skip(entryLength(e));
+    if(entryKind(e) != MATCH)
+      return 18;
+    size_t distance = entryValue(e) + br.peek(entryExtra(e));
+    br.skip(entryExtra(e));
+    if(distance > out.size - begin)
+      return 52;
+
+    // A match may overlap its own output, in 8 byte steps that is fine from a distance of 8 on
+    unsigned char* dst = out.data + out.size;
+    const unsigned char* src = dst - distance;
+    unsigned char* end = dst + length;
+    if(distance >= 8){
+      do{
+        memcpy(dst, src, 8);
+        dst += 8;
+        src += 8;
+      } while(dst < end);
+    }
+    else if(distance == 1)
+      memset(dst, *src, length);
+    else{
+      for (; dst!=end; dst++, src++)
+        *dst = *src;
+    }
+    out.size += length;
+  }
+}
+
+unsigned storedBlock(BitReader& br, Output& out)
+{
+  // back to whole bytes: the bytes still in the buffer are read again from the input
+  br.skip(br.count & 7);
+  size_t p = br.pos - br.count / 8;
+  br.buffer = 0;
+  br.count = 0;
+  if(p + 4 > br.size)
+    return 52;
+  unsigned len = br.in[p] | (br.in[p + 1] << 8), nlen = br.in[p + 2] | (br.in[p + 3] << 8);
+  if(len + nlen != 65535)
+    return 21;
+  p += 4;
+  if(len > br.size - p)
+    return 23;
+  if(!out.reserve(len))
+    return 83;
+  memcpy(out.data + out.size, br.in + p, len);
+  out.size += len;
+  br.pos = p + len;
+  return 0;
+}
+
+void fixedTables(uint32_t* litlen, uint32_t* dist)
+{
+  unsigned char lengths[288];
+  memset(lengths, 8, 144);
+  memset(lengths + 144, 9, 112);
+  memset(lengths + 256, 7, 24);
+  memset(lengths + 280, 8, 8);
+  buildTable(litlen, LITLEN_BITS, lengths, 288, litlenSymbol);
+  memset(lengths, 5, 32);
+  buildTable(dist, DIST_BITS, lengths, 32, distSymbol);
+}
+
+// The code lengths of a dynamic block, with the same error codes as lodepng's getTreeInflateDynamic
+unsigned dynamicTables(BitReader& br, uint32_t* litlen, uint32_t* dist)
+{
+  br.refill();
+  unsigned hlit = br.peek(5) + 257;
+  br.skip(5);
+  unsigned hdist = br.peek(5) + 1;
+  br.skip(5);
+  unsigned hclen = br.peek(4) + 4;
+  br.skip(4);
+  if(br.overrun())
+    return 49;
+
+  unsigned char cl[19];
+  memset(cl, 0, sizeof(cl));
+  for (unsigned i=0; i<hclen; i++){
+    br.refill();
+    cl[CODELENGTH_ORDER[i]] = (unsigned char) br.peek(3);
+    br.skip(3);
+  }
+  if(br.overrun())
+    return 50;
+  uint32_t cltable[1 << CODELENGTH_BITS];
+  if(!buildTable(cltable, CODELENGTH_BITS, cl, 19, codeLengthSymbol))
+    return 55;
+
+  unsigned char lengths[288 + 32];
+  unsigned n = hlit + hdist;
+  for (unsigned i=0; i<n; ){
+    br.refill();
+    uint32_t e = cltable[br.peek(CODELENGTH_BITS)];
+    if(entryKind(e) != LITERAL)
+      return br.overrun() ? 10 : 11;
+    br.skip(entryLength(e));
+    unsigned code = entryValue(e), value = 0, repeat;
+    if(code <= 15){
+      lengths[i++] = (unsigned char) code;
+      continue;
+    }
+    if(code == 16){
+      if(i == 0)
+        return 54;
+      value = lengths[i - 1];
+      repeat = 3 + br.peek(2);
+      br.skip(2);
+    }
+    else if(code == 17){
+      repeat = 3 + br.peek(3);
+      br.skip(3);
+    }
+    else{
+      repeat = 11 + br.peek(7);
+      br.skip(7);
+    }
+    if(br.overrun())
+      return 50;
+    if(repeat > n - i)
+      return code == 16 ? 13 : code == 17 ? 14 : 15;
+    memset(lengths + i, (int) value, repeat);
+    i += repeat;
+  }
+  if(br.overrun())
+    return 50;
+  if(lengths[256] == 0)
+    return 64;
+
+  if(!buildTable(litlen, LITLEN_BITS, lengths, hlit, litlenSymbol)
+     || !buildTable(dist, DIST_BITS, lengths + hlit, hdist, distSymbol))
+    return 55;
+  return 0;
+}
+
+} // namespace
+
+
+unsigned fastInflate(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                     const LodePNGDecompressSettings* settings)
+{
+  // The size the decoder expects, else a guess: PNG image data rarely inflates to more than 4 times its size
+  Output o;
+  o.size = *outsize;
+  o.capacity = *outsize + (settings && settings->expected_size ? settings->expected_size :
+                           insize < 16384 ? 65536 : insize * 4) + SLACK;
+  o.data = (unsigned char*) lodepng_malloc(o.capacity);
+  uint32_t* litlen = (uint32_t*) lodepng_malloc((LITLEN_TABLE + DIST_TABLE) * sizeof(uint32_t));
+  uint32_t* dist = litlen + LITLEN_TABLE;
+  BitReader br = { in, insize, 0, 0, 0 };
+  unsigned error = o.data && litlen ? 0 : 83;
+  if(!error && *outsize)
+    memcpy(o.data, *out, *outsize);
+
+  for (unsigned final=0; !error && !final; ){
+    br.refill();
+    final = br.peek(1);
+    br.skip(1);
+    unsigned type = br.peek(2);
+    br.skip(2);
+    if(br.overrun())
+      error = 52;
+    else if(type == 0)
+      error = storedBlock(br, o);
+    else if(type == 1){
+      fixedTables(litlen, dist);
+      error = inflateCodes(br, o, *outsize, litlen, dist);
+    }
+    else if(type == 2){
+      error = dynamicTables(br, litlen, dist);
+      if(!error)
+        error = inflateCodes(br, o, *outsize, litlen, dist);
+    }
+    else
+      error = 20;
+  }
+
+  lodepng_free(litlen);
+  if(error){
+    lodepng_free(o.data);
+    return error;
+  }
+  lodepng_free(*out);
+  *out = o.data;
+  *outsize = o.size;
+  return 0;
+}
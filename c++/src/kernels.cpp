@@ -0,0 +1,507 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      kernels.cpp
+   Description: Per instruction set pixel kernels for the NDVI stages, selected at run time
+   Language:    C++
+   Usage:
+                One portable binary carries a scalar, an SSE2 and an AVX2 set on x86 and a NEON set on
+                64-bit ARM. ndviKernels() picks the widest set the CPU supports once, under pthread_once,
+                so any thread may make the first call. The vector NDVI uses a real division (divps / vdivq)
+                rather than a refined reciprocal estimate, because only the correctly rounded quotient is
+                bit identical to the scalar code; on targets without a vector divide the scalar set uses the
+                lookup table.
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "analysis.h"
+#include "kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+
+// Scalar kernels: the NDVI is a table lookup, so there is no division in the pixel loop
+
+static void ndviScalar(const unsigned char* rgba, float* ndvi, size_t npixels)
+{
+  const float* table = ndviTable();
+  for (size_t i=0; i<npixels; i++)
+    ndvi[i] = table[(rgba[4 * i + 0] << 8) | rgba[4 * i + 2]];
+}
+
+static void scaleScalar(const float* in, float* scaled, size_t npixels, double black, double range)
+{
+  for (size_t i=0; i<npixels; i++)
+    scaled[i] = (float) (((in[i] - black)/range) * 255);
+}
+
+static void thresholdScalar(const float* in, uint64_t* mask, size_t npixels, int threshold)
+{
+  for (size_t w=0; 64 * w < npixels; w++){
+    size_t n = npixels - 64 * w < 64 ? npixels - 64 * w : 64;
+    uint64_t word = 0;
+    for (size_t b=0; b<n; b++)
+      if(in[64 * w + b] >= threshold)
+        word |= (uint64_t) 1 << b;
+    mask[w] = word;
+  }
+}
+
+static void expandScalar(const unsigned char* grey, unsigned char* rgba, size_t npixels)
+{
+  for (size_t i=0; i<npixels; i++){
+    rgba[4 * i + 0] = grey[i];
+    rgba[4 * i + 1] = grey[i];
+    rgba[4 * i + 2] = grey[i];
+    rgba[4 * i + 3] = 255;
+  }
+}
+
+static void pairsScalar(const unsigned char* ir, const unsigned char* blue, uint16_t* pair, size_t npixels)
+{
+  for (size_t i=0; i<npixels; i++)
+    pair[i] = (uint16_t) ((ir[i] << 8) | blue[i]);
+}
+
+static void minMaxScalar(const float* values, size_t n, float* min, float* max)
+{
+  float lo = *min, hi = *max;
+  for (size_t i=0; i<n; i++){
+    if(values[i] < lo)
+      lo = values[i];
+    if(hi < values[i])
+      hi = values[i];
+  }
+  *min = lo;
+  *max = hi;
+}
+
+static void packScalar(const unsigned char* flags, uint64_t* mask, size_t n)
+{
+  for (size_t w=0; 64 * w < n; w++){
+    size_t count = n - 64 * w < 64 ? n - 64 * w : 64;
+    uint64_t word = 0;
+    for (size_t b=0; b<count; b++)
+      word |= (uint64_t) flags[64 * w + b] << b;
+    mask[w] = word;
+  }
+}
+
+static const NDVIKernels scalarKernels = { "scalar", pairsScalar, minMaxScalar, packScalar,
+                                           ndviScalar, scaleScalar, thresholdScalar, expandScalar };
+
+
+#ifdef KERNELS_X86
+
+// SSE2 kernels, part of the x86-64 baseline so always available there
+
+static void ndviSSE2(const unsigned char* rgba, float* ndvi, size_t npixels)
+{
+  const __m128i low = _mm_set1_epi32(0xFF);
+  const __m128 zero = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= npixels; i += 8){
+    for (int half=0; half<2; half++){
+      // 4 RGBA pixels: IR is the low byte of each 32-bit lane, blue the third
+      __m128i px = _mm_loadu_si128((const __m128i*) (rgba + 4 * (i + 4 * half)));
+      __m128 ir = _mm_cvtepi32_ps(_mm_and_si128(px, low));
+      __m128 blue = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), low));
+      __m128 denominator = _mm_add_ps(ir, blue);
+      __m128 pixel = _mm_div_ps(_mm_sub_ps(ir, blue), denominator);
+      _mm_storeu_ps(ndvi + i + 4 * half, _mm_and_ps(pixel, _mm_cmpneq_ps(denominator, zero)));
+    }
+  }
+  ndviScalar(rgba + 4 * i, ndvi + i, npixels - i);
+}
+
+static void scaleSSE2(const float* in, float* scaled, size_t npixels, double black, double range)
+{
+  const __m128d vblack = _mm_set1_pd(black);
+  const __m128d vrange = _mm_set1_pd(range);
+  const __m128d v255 = _mm_set1_pd(255.0);
+  size_t i = 0;
+  for (; i + 8 <= npixels; i += 8){
+    for (int j=0; j<8; j+=4){
+      __m128 x = _mm_loadu_ps(in + i + j);
+      __m128d lo = _mm_cvtps_pd(x);
+      __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+      lo = _mm_mul_pd(_mm_div_pd(_mm_sub_pd(lo, vblack), vrange), v255);
+      hi = _mm_mul_pd(_mm_div_pd(_mm_sub_pd(hi, vblack), vrange), v255);
+      _mm_storeu_ps(scaled + i + j, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+    }
+  }
+  scaleScalar(in + i, scaled + i, npixels - i, black, range);
+}
+
+static void thresholdSSE2(const float* in, uint64_t* mask, size_t npixels, int threshold)
+{
+  const __m128 t = _mm_set1_ps((float) threshold);
+  size_t w = 0;
+  for (; 64 * (w + 1) <= npixels; w++){
+    // 4 compare bits per movemask, 16 of them fill a mask word
+    uint64_t word = 0;
+    for (int j=0; j<64; j+=4)
+      word |= (uint64_t) _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(in + 64 * w + j), t)) << j;
+    mask[w] = word;
+  }
+  thresholdScalar(in + 64 * w, mask + w, npixels - 64 * w, threshold);
+}
+
+static void expandSSE2(const unsigned char* grey, unsigned char* rgba, size_t npixels)
+{
+  const __m128i alpha = _mm_set1_epi32((int) 0xFF000000u);
+  size_t i = 0;
+  for (; i + 16 <= npixels; i += 16){
+    __m128i g = _mm_loadu_si128((const __m128i*) (grey + i));
+    __m128i gg_lo = _mm_unpacklo_epi8(g, g);
+    __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+    __m128i out[4];
+    out[0] = _mm_unpacklo_epi16(gg_lo, gg_lo);
+    out[1] = _mm_unpackhi_epi16(gg_lo, gg_lo);
+    out[2] = _mm_unpacklo_epi16(gg_hi, gg_hi);
+    out[3] = _mm_unpackhi_epi16(gg_hi, gg_hi);
+    for (int j=0; j<4; j++)
+      _mm_storeu_si128((__m128i*) (rgba + 4 * i + 16 * j), _mm_or_si128(out[j], alpha));
+  }
+  expandScalar(grey + i, rgba + 4 * i, npixels - i);
+}
+
+static void pairsSSE2(const unsigned char* ir, const unsigned char* blue, uint16_t* pair, size_t npixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= npixels; i += 16){
+    // blue in the low and IR in the high byte of each little endian 16-bit lane
+    __m128i b = _mm_loadu_si128((const __m128i*) (blue + i));
+    __m128i r = _mm_loadu_si128((const __m128i*) (ir + i));
+    _mm_storeu_si128((__m128i*) (pair + i), _mm_unpacklo_epi8(b, r));
+    _mm_storeu_si128((__m128i*) (pair + i + 8), _mm_unpackhi_epi8(b, r));
+  }
+  pairsScalar(ir + i, blue + i, pair + i, npixels - i);
+}
+
+// The values hold no NaN, so minps and maxps choose as the compares of minMaxScalar do
+static void minMaxSSE2(const float* values, size_t n, float* min, float* max)
+{
+  __m128 lo = _mm_set1_ps(*min), hi = _mm_set1_ps(*max);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4){
+    __m128 x = _mm_loadu_ps(values + i);
+    lo = _mm_min_ps(lo, x);
+    hi = _mm_max_ps(hi, x);
+  }
+  lo = _mm_min_ps(lo, _mm_movehl_ps(lo, lo));
+  lo = _mm_min_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+  hi = _mm_max_ps(hi, _mm_movehl_ps(hi, hi));
+  hi = _mm_max_ss(hi, _mm_shuffle_ps(hi, hi, 1));
+  _mm_store_ss(min, lo);
+  _mm_store_ss(max, hi);
+  minMaxScalar(values + i, n - i, min, max);
+}
+
+static void packSSE2(const unsigned char* flags, uint64_t* mask, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t w = 0;
+  for (; 64 * (w + 1) <= n; w++){
+    // 16 flag bits per movemask of the flags compared against 0
+    uint64_t word = 0;
+    for (int j=0; j<64; j+=16){
+      __m128i x = _mm_loadu_si128((const __m128i*) (flags + 64 * w + j));
+      word |= (uint64_t) (unsigned) _mm_movemask_epi8(_mm_cmpgt_epi8(x, zero)) << j;
+    }
+    mask[w] = word;
+  }
+  packScalar(flags + 64 * w, mask + w, n - 64 * w);
+}
+
+static const NDVIKernels sse2Kernels = { "sse2", pairsSSE2, minMaxSSE2, packSSE2,
+                                         ndviSSE2, scaleSSE2, thresholdSSE2, expandSSE2 };
+
+
+// AVX2 kernels, compiled for AVX2 only inside these functions and used only if the CPU reports it
+
+TARGET_AVX2 static void ndviAVX2(const unsigned char* rgba, float* ndvi, size_t npixels)
+{
+  const __m256i low = _mm256_set1_epi32(0xFF);
+  const __m256 zero = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= npixels; i += 16){
+    for (int half=0; half<2; half++){
+      __m256i px = _mm256_loadu_si256((const __m256i*) (rgba + 4 * (i + 8 * half)));
+      __m256 ir = _mm256_cvtepi32_ps(_mm256_and_si256(px, low));
+      __m256 blue = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), low));
+      __m256 denominator = _mm256_add_ps(ir, blue);
+      __m256 pixel = _mm256_div_ps(_mm256_sub_ps(ir, blue), denominator);
+      _mm256_storeu_ps(ndvi + i + 8 * half, _mm256_and_ps(pixel, _mm256_cmp_ps(denominator, zero, _CMP_NEQ_UQ)));
+    }
+  }
+  ndviScalar(rgba + 4 * i, ndvi + i, npixels - i);
+}
+
+TARGET_AVX2 static void scaleAVX2(const float* in, float* scaled, size_t npixels, double black, double range)
+{
+  const __m256d vblack = _mm256_set1_pd(black);
+  const __m256d vrange = _mm256_set1_pd(range);
+  const __m256d v255 = _mm256_set1_pd(255.0);
+  size_t i = 0;
+  for (; i + 8 <= npixels; i += 8){
+    __m256d lo = _mm256_cvtps_pd(_mm_loadu_ps(in + i));
+    __m256d hi = _mm256_cvtps_pd(_mm_loadu_ps(in + i + 4));
+    lo = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(lo, vblack), vrange), v255);
+    hi = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(hi, vblack), vrange), v255);
+    _mm_storeu_ps(scaled + i, _mm256_cvtpd_ps(lo));
+    _mm_storeu_ps(scaled + i + 4, _mm256_cvtpd_ps(hi));
+  }
+  scaleScalar(in + i, scaled + i, npixels - i, black, range);
+}
+
+TARGET_AVX2 static void thresholdAVX2(const float* in, uint64_t* mask, size_t npixels, int threshold)
+{
+  const __m256 t = _mm256_set1_ps((float) threshold);
+  size_t w = 0;
+  for (; 64 * (w + 1) <= npixels; w++){
+    uint64_t word = 0;
+    for (int j=0; j<64; j+=8)
+      word |= (uint64_t) _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(in + 64 * w + j), t, _CMP_GE_OQ)) << j;
+    mask[w] = word;
+  }
+  thresholdScalar(in + 64 * w, mask + w, npixels - 64 * w, threshold);
+}
+
+TARGET_AVX2 static void expandAVX2(const unsigned char* grey, unsigned char* rgba, size_t npixels)
+{
+  const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000u);
+  size_t i = 0;
+  for (; i + 32 <= npixels; i += 32){
+    // 8 greyscale bytes become 8 RGBA pixels in each 256-bit register
+    for (int j=0; j<32; j+=8){
+      __m256i g = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (grey + i + j)));
+      g = _mm256_mullo_epi32(g, _mm256_set1_epi32(0x00010101));
+      _mm256_storeu_si256((__m256i*) (rgba + 4 * (i + j)), _mm256_or_si256(g, alpha));
+    }
+  }
+  expandScalar(grey + i, rgba + 4 * i, npixels - i);
+}
+
+TARGET_AVX2 static void pairsAVX2(const unsigned char* ir, const unsigned char* blue, uint16_t* pair, size_t npixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= npixels; i += 16){
+    // widened to 16-bit lanes, which avoids the per 128-bit lane unpack of AVX2
+    __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (blue + i)));
+    __m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (ir + i)));
+    _mm256_storeu_si256((__m256i*) (pair + i), _mm256_or_si256(_mm256_slli_epi16(r, 8), b));
+  }
+  pairsScalar(ir + i, blue + i, pair + i, npixels - i);
+}
+
+TARGET_AVX2 static void minMaxAVX2(const float* values, size_t n, float* min, float* max)
+{
+  __m256 lo = _mm256_set1_ps(*min), hi = _mm256_set1_ps(*max);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8){
+    __m256 x = _mm256_loadu_ps(values + i);
+    lo = _mm256_min_ps(lo, x);
+    hi = _mm256_max_ps(hi, x);
+  }
+  __m128 lo4 = _mm_min_ps(_mm256_castps256_ps128(lo), _mm256_extractf128_ps(lo, 1));
+  __m128 hi4 = _mm_max_ps(_mm256_castps256_ps128(hi), _mm256_extractf128_ps(hi, 1));
+  lo4 = _mm_min_ps(lo4, _mm_movehl_ps(lo4, lo4));
+  lo4 = _mm_min_ss(lo4, _mm_shuffle_ps(lo4, lo4, 1));
+  hi4 = _mm_max_ps(hi4, _mm_movehl_ps(hi4, hi4));
+  hi4 = _mm_max_ss(hi4, _mm_shuffle_ps(hi4, hi4, 1));
+  _mm_store_ss(min, lo4);
+  _mm_store_ss(max, hi4);
+  minMaxScalar(values + i, n - i, min, max);
+}
+
+TARGET_AVX2 static void packAVX2(const unsigned char* flags, uint64_t* mask, size_t n)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  size_t w = 0;
+  for (; 64 * (w + 1) <= n; w++){
+    __m256i x0 = _mm256_loadu_si256((const __m256i*) (flags + 64 * w));
+    __m256i x1 = _mm256_loadu_si256((const __m256i*) (flags + 64 * w + 32));
+    uint64_t lo = (unsigned) _mm256_movemask_epi8(_mm256_cmpgt_epi8(x0, zero));
+    uint64_t hi = (unsigned) _mm256_movemask_epi8(_mm256_cmpgt_epi8(x1, zero));
+    mask[w] = lo | (hi << 32);
+  }
+  packScalar(flags + 64 * w, mask + w, n - 64 * w);
+}
+
+static const NDVIKernels avx2Kernels = { "avx2", pairsAVX2, minMaxAVX2, packAVX2,
+                                         ndviAVX2, scaleAVX2, thresholdAVX2, expandAVX2 };
+
+#endif // KERNELS_X86
+
+
+#ifdef KERNELS_NEON
+
+// NEON kernels for 64-bit ARM, which has a correctly rounded vector divide
+
+static void ndviNEON(const unsigned char* rgba, float* ndvi, size_t npixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= npixels; i += 16){
+    uint8x16x4_t px = vld4q_u8(rgba + 4 * i); // deinterleaves R, G, B and A
+    uint16x8_t ir16[2] = { vmovl_u8(vget_low_u8(px.val[0])), vmovl_u8(vget_high_u8(px.val[0])) };
+    uint16x8_t blue16[2] = { vmovl_u8(vget_low_u8(px.val[2])), vmovl_u8(vget_high_u8(px.val[2])) };
+    for (int j=0; j<4; j++){
+      uint16x4_t irpart = (j & 1) ? vget_high_u16(ir16[j >> 1]) : vget_low_u16(ir16[j >> 1]);
+      uint16x4_t bluepart = (j & 1) ? vget_high_u16(blue16[j >> 1]) : vget_low_u16(blue16[j >> 1]);
+      float32x4_t ir = vcvtq_f32_u32(vmovl_u16(irpart));
+      float32x4_t blue = vcvtq_f32_u32(vmovl_u16(bluepart));
+      float32x4_t denominator = vaddq_f32(ir, blue);
+      float32x4_t pixel = vdivq_f32(vsubq_f32(ir, blue), denominator);
+      uint32x4_t valid = vmvnq_u32(vceqq_f32(denominator, vdupq_n_f32(0.0f)));
+      vst1q_f32(ndvi + i + 4 * j, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(pixel), valid)));
+    }
+  }
+  ndviScalar(rgba + 4 * i, ndvi + i, npixels - i);
+}
+
+static void scaleNEON(const float* in, float* scaled, size_t npixels, double black, double range)
+{
+  const float64x2_t vblack = vdupq_n_f64(black);
+  const float64x2_t vrange = vdupq_n_f64(range);
+  const float64x2_t v255 = vdupq_n_f64(255.0);
+  size_t i = 0;
+  for (; i + 4 <= npixels; i += 4){
+    float32x4_t x = vld1q_f32(in + i);
+    float64x2_t lo = vcvt_f64_f32(vget_low_f32(x));
+    float64x2_t hi = vcvt_high_f64_f32(x);
+    lo = vmulq_f64(vdivq_f64(vsubq_f64(lo, vblack), vrange), v255);
+    hi = vmulq_f64(vdivq_f64(vsubq_f64(hi, vblack), vrange), v255);
+    vst1q_f32(scaled + i, vcvt_high_f32_f64(vcvt_f32_f64(lo), hi));
+  }
+  scaleScalar(in + i, scaled + i, npixels - i, black, range);
+}
+
+static void thresholdNEON(const float* in, uint64_t* mask, size_t npixels, int threshold)
+{
+  const float32x4_t t = vdupq_n_f32((float) threshold);
+  const uint32_t lanebits[4] = { 1, 2, 4, 8 };
+  const uint32x4_t lanes = vld1q_u32(lanebits);
+  size_t w = 0;
+  for (; 64 * (w + 1) <= npixels; w++){
+    // NEON has no movemask: keep one distinct bit per lane and add the lanes up
+    uint64_t word = 0;
+    for (int j=0; j<64; j+=4)
+      word |= (uint64_t) vaddvq_u32(vandq_u32(vcgeq_f32(vld1q_f32(in + 64 * w + j), t), lanes)) << j;
+    mask[w] = word;
+  }
+  thresholdScalar(in + 64 * w, mask + w, npixels - 64 * w, threshold);
+}
+
+static void expandNEON(const unsigned char* grey, unsigned char* rgba, size_t npixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= npixels; i += 16){
+    uint8x16x4_t px;
+    px.val[0] = px.val[1] = px.val[2] = vld1q_u8(grey + i);
+    px.val[3] = vdupq_n_u8(255);
+    vst4q_u8(rgba + 4 * i, px); // interleaves back to RGBA
+  }
+  expandScalar(grey + i, rgba + 4 * i, npixels - i);
+}
+
+static void pairsNEON(const unsigned char* ir, const unsigned char* blue, uint16_t* pair, size_t npixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= npixels; i += 16){
+    // interleaved as blue, IR byte pairs, which are the little endian 16-bit pair indices
+    uint8x16x2_t px;
+    px.val[0] = vld1q_u8(blue + i);
+    px.val[1] = vld1q_u8(ir + i);
+    vst2q_u8((unsigned char*) (pair + i), px);
+  }
+  pairsScalar(ir + i, blue + i, pair + i, npixels - i);
+}
+
+static void minMaxNEON(const float* values, size_t n, float* min, float* max)
+{
+  float32x4_t lo = vdupq_n_f32(*min), hi = vdupq_n_f32(*max);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4){
+    float32x4_t x = vld1q_f32(values + i);
+    lo = vminq_f32(lo, x);
+    hi = vmaxq_f32(hi, x);
+  }
+  *min = vminvq_f32(lo);
+  *max = vmaxvq_f32(hi);
+  minMaxScalar(values + i, n - i, min, max);
+}
+
+static void packNEON(const unsigned char* flags, uint64_t* mask, size_t n)
+{
+  const int8_t lanebits[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7 };
+  const int8x16_t shifts = vld1q_s8(lanebits);
+  size_t w = 0;
+  for (; 64 * (w + 1) <= n; w++){
+    // each 0/1 flag shifted to its bit of the byte, then the 8 bytes of each half added up
+    uint64_t word = 0;
+    for (int j=0; j<64; j+=16){
+      uint8x16_t bits = vshlq_u8(vld1q_u8(flags + 64 * w + j), shifts);
+      word |= (uint64_t) vaddv_u8(vget_low_u8(bits)) << j;
+      word |= (uint64_t) vaddv_u8(vget_high_u8(bits)) << (j + 8);
+    }
+    mask[w] = word;
+  }
+  packScalar(flags + 64 * w, mask + w, n - 64 * w);
+}
+
+static const NDVIKernels neonKernels = { "neon", pairsNEON, minMaxNEON, packNEON,
+                                         ndviNEON, scaleNEON, thresholdNEON, expandNEON };
+
+#endif // KERNELS_NEON
+
+
+// The kernels with the given name, if built in and supported by this CPU
+const NDVIKernels* ndviKernelSet(const char* name)
+{
+  if(strcmp(name, "scalar") == 0)
+    return &scalarKernels;
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  if(strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+    return &sse2Kernels;
+  if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    return &avx2Kernels;
+#endif
+#ifdef KERNELS_NEON
+  if(strcmp(name, "neon") == 0)
+    return &neonKernels;
+#endif
+  return 0;
+}
+
+
+// Pick the widest supported set once, unless PLANTHEALTH_KERNELS asks for a specific one
+static const NDVIKernels* selected = 0;
+static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+
+static void selectKernels()
+{
+  const char* requested = getenv("PLANTHEALTH_KERNELS");
+  if(requested)
+    selected = ndviKernelSet(requested);
+  const char* preference[] = { "avx2", "sse2", "neon", "scalar" };
+  for (int i=0; !selected && i<4; i++)
+    selected = ndviKernelSet(preference[i]);
+}
+
+const NDVIKernels& ndviKernels()
+{
+  pthread_once(&selectOnce, selectKernels);
+  return *selected;
+}
@@ -32,11 +32,28 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifdef LODEPNG_COMPILE_CPP
 #include <fstream>
 #endif /*LODEPNG_COMPILE_CPP*/
 
+#ifdef LODEPNG_COMPILE_SIMD
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LODEPNG_SIMD_X86
+#include <immintrin.h>
+#define LODEPNG_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define LODEPNG_TARGET_PCLMUL __attribute__((target("sse2,pclmul")))
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define LODEPNG_SIMD_NEON
+#include <arm_neon.h>
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+#endif
+#endif /*LODEPNG_COMPILE_SIMD*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -259,16 +276,6 @@ static void ucvector_init(ucvector* p)
   p->size = p->allocsize = 0;
 }
 
-#ifdef LODEPNG_COMPILE_DECODER
-/*resize and give all new elements the value*/
-static unsigned ucvector_resizev(ucvector* p, size_t size, unsigned char value)
-{
-  size_t oldsize = p->size, i;
-  if(!ucvector_resize(p, size)) return 0;
-  for(i = oldsize; i < size; ++i) p->data[i] = value;
-  return 1;
-}
-#endif /*LODEPNG_COMPILE_DECODER*/
 #endif /*LODEPNG_COMPILE_PNG*/
 
 #ifdef LODEPNG_COMPILE_ZLIB
@@ -408,6 +415,16 @@ unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const
 
 #endif /*LODEPNG_COMPILE_DISK*/
 
+#ifdef LODEPNG_COMPILE_DECODER
+/*Receives inflated data piece by piece when the decoder streams instead of filling one output buffer.
+write returns an error code, or 0 to carry on decoding.*/
+typedef struct InflateSink
+{
+  unsigned (*write)(void* user, const unsigned char* data, size_t size);
+  void* user;
+} InflateSink;
+#endif /*LODEPNG_COMPILE_DECODER*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* ////////////////////////////////////////////////////////////////////////// */
 /* // End of common code and tools. Begin of Zlib related code.            // */
@@ -441,25 +458,104 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Bit reader for the inflator. The next bits of the input are kept in a 64-bit buffer, first bit in the lowest
+bit, and a refill tops it up to at least 56 bits with a single 8 byte load, so a literal/length symbol, a
+distance symbol and their extra bits can be taken from the buffer after one refill. The last 7 bytes of the
+input are loaded one at a time, and past the end of the input it reads zero bytes, so decoding never reads
+outside of the input and errors are found by comparing the bit position with the input size instead.
+*/
+typedef struct BitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t pos; /*next byte of data to load, past size when zero bytes were read beyond the end*/
+  uint64_t buffer; /*the next count bits of the input, bits above count may hold bits of data[pos]*/
+  unsigned count;
+} BitReader;
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+static void BitReader_init(BitReader* reader, const unsigned char* data, size_t size)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  ++(*bitpointer);
-  return result;
+  reader->data = data;
+  reader->size = size;
+  reader->pos = 0;
+  reader->buffer = 0;
+  reader->count = 0;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*ensures at least 56 bits are in the buffer*/
+static void BitReader_refill(BitReader* reader)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
+  if(reader->pos + 8 <= reader->size)
+  {
+    const unsigned char* p = reader->data + reader->pos;
+    uint64_t word = (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+                  | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+    /*only the whole bytes that fit are counted as loaded, the bits of the next byte that also landed in
+    the buffer are the same ones the next refill puts there*/
+    reader->buffer |= word << reader->count;
+    reader->pos += (63 - reader->count) >> 3;
+    reader->count |= 56;
+  }
+  else
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
+    while(reader->count <= 56)
+    {
+      if(reader->pos < reader->size) reader->buffer |= (uint64_t)reader->data[reader->pos] << reader->count;
+      ++reader->pos;
+      reader->count += 8;
+    }
   }
+}
+
+/*the next nbits bits (at most 32) without consuming them, the caller makes sure there are enough in the buffer*/
+static unsigned BitReader_peek(const BitReader* reader, unsigned nbits)
+{
+  return (unsigned)(reader->buffer & ((((uint64_t)1) << nbits) - 1u));
+}
+
+static void BitReader_skip(BitReader* reader, unsigned nbits)
+{
+  reader->buffer >>= nbits;
+  reader->count -= nbits;
+}
+
+/*the next nbits bits (at most 32), refilling first if the buffer doesn't have them*/
+static unsigned BitReader_read(BitReader* reader, unsigned nbits)
+{
+  unsigned result;
+  if(reader->count < nbits) BitReader_refill(reader);
+  result = BitReader_peek(reader, nbits);
+  BitReader_skip(reader, nbits);
   return result;
 }
+
+/*position in bits of the next bit to read*/
+static size_t BitReader_bitpos(const BitReader* reader)
+{
+  return reader->pos * 8 - reader->count;
+}
+
+/*whether more bits were consumed than the input has*/
+static int BitReader_overrun(const BitReader* reader)
+{
+  return reader->pos > reader->size && (reader->pos - reader->size) * 8 > reader->count;
+}
+
+/*skips to the next byte boundary and returns the position of that byte, for reading bytes directly*/
+static size_t BitReader_alignToByte(BitReader* reader)
+{
+  BitReader_skip(reader, reader->count & 7u);
+  return reader->pos - reader->count / 8;
+}
+
+/*continues reading bits from byte p on, after bytes were read directly*/
+static void BitReader_seekToByte(BitReader* reader, size_t p)
+{
+  reader->pos = p;
+  reader->buffer = 0;
+  reader->count = 0;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -507,11 +603,13 @@ Huffman tree struct, containing multiple representations of the tree
 */
 typedef struct HuffmanTree
 {
-  unsigned* tree2d;
   unsigned* tree1d;
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*for reading codes by table lookup, see HuffmanTree_makeTable*/
+  unsigned char* table_len; /*length of the symbol or of the longest code behind a second table*/
+  unsigned short* table_value; /*the symbol, or the offset of a second table*/
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -529,74 +627,173 @@ static void HuffmanTree_draw(HuffmanTree* tree)
 
 static void HuffmanTree_init(HuffmanTree* tree)
 {
-  tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
 {
-  lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_len);
+  lodepng_free(tree->table_value);
+}
+
+/*the decoder looks up the next FIRSTBITS bits of the input in one table, and longer codes in a second one*/
+#define FIRSTBITS 9u
+/*table_len of entries that have not been filled in yet*/
+#define UNFILLEDLEN 16u
+/*symbol returned for bit patterns that no code starts with*/
+#define INVALIDSYMBOL 65535u
+
+/*reverse the lowest num bits of bits*/
+static unsigned reverseBits(unsigned bits, unsigned num)
+{
+  unsigned i, result = 0;
+  for(i = 0; i < num; ++i) result |= ((bits >> (num - i - 1u)) & 1u) << i;
+  return result;
 }
 
-/*the tree representation used by the decoder. return value is error*/
-static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
+/*
+the tables used by the decoder, made from tree1d and lengths. return value is error.
+The deflate bit order puts the first bit of a code in the lowest bit, so a table index is the next bits of the
+input as they come, which is the code reversed. table_len and table_value have one entry for each of the
+2^FIRSTBITS possible next FIRSTBITS bits of the input:
+-a code of at most FIRSTBITS bits fills every entry that starts with it with its length and symbol.
+-for codes that are longer, the entry of their first FIRSTBITS bits has the length of the longest of them and
+ the offset in the tables of a second table for their remaining bits, filled in the same way.
+*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
 {
-  unsigned nodefilled = 0; /*up to which node it is filled*/
-  unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
-  unsigned n, i;
+  static const unsigned headsize = 1u << FIRSTBITS;
+  static const unsigned mask = (1u << FIRSTBITS) - 1u;
+  size_t i, numpresent, pointer, size; /*total table size*/
+  unsigned* maxlens = (unsigned*)lodepng_malloc(headsize * sizeof(unsigned));
+  if(!maxlens) return 83; /*alloc fail*/
 
-  tree->tree2d = (unsigned*)lodepng_malloc(tree->numcodes * 2 * sizeof(unsigned));
-  if(!tree->tree2d) return 83; /*alloc fail*/
+  /*compute maxlens: max total bit length of symbols sharing prefix in the first table*/
+  for(i = 0; i < headsize; ++i) maxlens[i] = 0;
+  for(i = 0; i < tree->numcodes; i++)
+  {
+    unsigned symbol = tree->tree1d[i];
+    unsigned l = tree->lengths[i];
+    unsigned index;
+    if(l <= FIRSTBITS) continue; /*symbols that fit in first table don't increase secondary table size*/
+    /*get the FIRSTBITS MSBs, the MSBs of the symbol are encoded first. See later comment about the reversing*/
+    index = reverseBits(symbol >> (l - FIRSTBITS), FIRSTBITS);
+    if(maxlens[index] < l) maxlens[index] = l;
+  }
+  /*compute total table size: size of first table plus all secondary tables for symbols longer than FIRSTBITS*/
+  size = headsize;
+  for(i = 0; i < headsize; ++i)
+  {
+    unsigned l = maxlens[i];
+    if(l > FIRSTBITS) size += (1u << (l - FIRSTBITS));
+  }
+  tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(*tree->table_len));
+  tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(*tree->table_value));
+  if(!tree->table_len || !tree->table_value)
+  {
+    lodepng_free(maxlens);
+    /*freeing tree->table values is done at a higher scope*/
+    return 83; /*alloc fail*/
+  }
+  /*initialize with an invalid length to indicate unused entries*/
+  for(i = 0; i < size; ++i) tree->table_len[i] = UNFILLEDLEN;
 
-  /*
-  convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
-  uninited, a value >= numcodes is an address to another bit, a value < numcodes
-  is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as
-  many columns as codes - 1.
-  A good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes.
-  Here, the internal nodes are stored (what their 0 and 1 option point to).
-  There is only memory for such good tree currently, if there are more nodes
-  (due to too long length codes), error 55 will happen
-  */
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  /*fill in the first table for long symbols: max prefix size and pointer to secondary tables*/
+  pointer = headsize;
+  for(i = 0; i < headsize; ++i)
   {
-    tree->tree2d[n] = 32767; /*32767 here means the tree2d isn't filled there yet*/
+    unsigned l = maxlens[i];
+    if(l <= FIRSTBITS) continue;
+    tree->table_len[i] = l;
+    tree->table_value[i] = (unsigned short)pointer;
+    pointer += (1u << (l - FIRSTBITS));
   }
+  lodepng_free(maxlens);
 
-  for(n = 0; n < tree->numcodes; ++n) /*the codes*/
+  /*fill in the first table for short symbols, or secondary table for long symbols*/
+  numpresent = 0;
+  for(i = 0; i < tree->numcodes; ++i)
   {
-    for(i = 0; i != tree->lengths[n]; ++i) /*the bits for this code*/
+    unsigned l = tree->lengths[i];
+    unsigned symbol = tree->tree1d[i]; /*the huffman bit pattern. i itself is the value.*/
+    /*reverse bits, because the huffman bits are given in MSB first order but the bit reader reads LSB first*/
+    unsigned reverse;
+    if(l == 0) continue;
+    reverse = reverseBits(symbol, l);
+    numpresent++;
+
+    if(l <= FIRSTBITS)
     {
-      unsigned char bit = (unsigned char)((tree->tree1d[n] >> (tree->lengths[n] - i - 1)) & 1);
-      /*oversubscribed, see comment in lodepng_error_text*/
-      if(treepos > 2147483647 || treepos + 2 > tree->numcodes) return 55;
-      if(tree->tree2d[2 * treepos + bit] == 32767) /*not yet filled in*/
+      /*short symbol, fully in first table, replicated num times if l < FIRSTBITS*/
+      unsigned num = 1u << (FIRSTBITS - l);
+      unsigned j;
+      for(j = 0; j < num; ++j)
       {
-        if(i + 1 == tree->lengths[n]) /*last bit*/
-        {
-          tree->tree2d[2 * treepos + bit] = n; /*put the current code in it*/
-          treepos = 0;
-        }
-        else
-        {
-          /*put address of the next step in here, first that address has to be found of course
-          (it's just nodefilled + 1)...*/
-          ++nodefilled;
-          /*addresses encoded with numcodes added to it*/
-          tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;
-          treepos = nodefilled;
-        }
+        /*bit reader will read the l bits of symbol first, the remaining FIRSTBITS - l bits go to the MSB's*/
+        unsigned index = reverse | (j << l);
+        if(tree->table_len[index] != UNFILLEDLEN) return 55; /*invalid tree: long symbol shares prefix with short symbol*/
+        tree->table_len[index] = l;
+        tree->table_value[index] = (unsigned short)i;
+      }
+    }
+    else
+    {
+      /*long symbol, shares prefix with other long symbols in first lookup table, needs second lookup*/
+      /*the FIRSTBITS MSBs of the symbol are the first table index*/
+      unsigned index = reverse & mask;
+      unsigned maxlen = tree->table_len[index];
+      /*log2 of secondary table length, should be >= l - FIRSTBITS*/
+      unsigned tablelen = maxlen - FIRSTBITS;
+      unsigned start = tree->table_value[index]; /*starting index in secondary table*/
+      unsigned num = 1u << (tablelen - (l - FIRSTBITS)); /*amount of entries of this symbol in secondary table*/
+      unsigned j;
+      if(maxlen < l) return 55; /*invalid tree: long symbol shares prefix with short symbol*/
+      for(j = 0; j < num; ++j)
+      {
+        unsigned reverse2 = reverse >> FIRSTBITS; /* l - FIRSTBITS bits */
+        unsigned index2 = start + (reverse2 | (j << (l - FIRSTBITS)));
+        if(tree->table_len[index2] != UNFILLEDLEN) return 55; /*invalid tree: codes overlap*/
+        tree->table_len[index2] = l;
+        tree->table_value[index2] = (unsigned short)i;
       }
-      else treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
     }
   }
 
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  if(numpresent < 2)
   {
-    if(tree->tree2d[n] == 32767) tree->tree2d[n] = 0; /*remove possible remaining 32767's*/
+    /*In case of exactly 1 symbol, in theory the huffman symbol needs 0 bits,
+    but deflate uses 1 bit instead. In case of 0 symbols, no symbols can
+    appear at all, but such huffman tree could still exist (e.g. if distance
+    codes are never used). In both cases, not all symbols of the table will be
+    filled in. Fill them in with an invalid symbol value so returning them from
+    huffmanDecodeSymbol will cause error.*/
+    for(i = 0; i < size; ++i)
+    {
+      if(tree->table_len[i] == UNFILLEDLEN)
+      {
+        /*As length, use a value smaller than FIRSTBITS for the head table,
+        and a value larger than FIRSTBITS for the secondary table, so that
+        huffmanDecodeSymbol reads them as a complete symbol.*/
+        tree->table_len[i] = (i < headsize) ? 1 : (FIRSTBITS + 1);
+        tree->table_value[i] = INVALIDSYMBOL;
+      }
+    }
+  }
+  else
+  {
+    /*A good huffman tree has N * 2 - 1 nodes, of which N - 1 are internal nodes.
+    If that is not the case (due to too long length codes), the table will not
+    have been fully used, and this is an error (not all bit combinations can be
+    decoded): an oversubscribed huffman tree, indicated by error 55.*/
+    for(i = 0; i < size; ++i)
+    {
+      if(tree->table_len[i] == UNFILLEDLEN) return 55;
+    }
   }
 
   return 0;
@@ -643,8 +840,7 @@ static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
   uivector_cleanup(&blcount);
   uivector_cleanup(&nextcode);
 
-  if(!error) return HuffmanTree_make2DTree(tree);
-  else return error;
+  return error;
 }
 
 /*
@@ -655,13 +851,15 @@ return value is error.
 static unsigned HuffmanTree_makeFromLengths(HuffmanTree* tree, const unsigned* bitlen,
                                             size_t numcodes, unsigned maxbitlen)
 {
-  unsigned i;
+  unsigned i, error;
   tree->lengths = (unsigned*)lodepng_malloc(numcodes * sizeof(unsigned));
   if(!tree->lengths) return 83; /*alloc fail*/
   for(i = 0; i != numcodes; ++i) tree->lengths[i] = bitlen[i];
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
   tree->maxbitlen = maxbitlen;
-  return HuffmanTree_makeFromLengths2(tree);
+  error = HuffmanTree_makeFromLengths2(tree);
+  if(!error) error = HuffmanTree_makeTable(tree);
+  return error;
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -697,6 +895,8 @@ static void coin_copy(Coin* c1, const Coin* c2)
 static void add_coins(Coin* c1, const Coin* c2)
 {
   size_t i;
+  /*room for both at once, rather than growing one symbol at a time*/
+  uivector_reserve(&c1->symbols, (c1->symbols.size + c2->symbols.size) * sizeof(unsigned));
   for(i = 0; i != c2->symbols.size; ++i) uivector_push_back(&c1->symbols, c2->symbols.data[i]);
   c1->weight += c2->weight;
 }
@@ -921,26 +1121,26 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 
 /*
 returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+The caller makes sure at least 15 bits are in the buffer of the reader, the longest code length.
+The first FIRSTBITS bits give the symbol straight away for all but the longest codes, which take one more
+lookup in a second table, see HuffmanTree_makeTable.
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbol(BitReader* reader, const HuffmanTree* codetree)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
+  unsigned code = BitReader_peek(reader, FIRSTBITS);
+  unsigned l = codetree->table_len[code];
+  unsigned value = codetree->table_value[code];
+  if(l > FIRSTBITS)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    ++(*bp);
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
-
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+    /*long code: the rest of its bits index the second table*/
+    unsigned index2 = value + ((BitReader_peek(reader, l) >> FIRSTBITS));
+    l = codetree->table_len[index2];
+    value = codetree->table_value[index2];
   }
+  BitReader_skip(reader, l);
+  /*error: end of input memory reached without endcode, or a code that is not in the tree*/
+  if(value == INVALIDSYMBOL || BitReader_overrun(reader)) return (unsigned)(-1);
+  return value;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -960,12 +1160,12 @@ static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
 static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+                                      BitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
+  size_t inbitlength = reader->size * 8;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   unsigned* bitlen_ll = 0; /*lit,len code lengths*/
@@ -974,16 +1174,16 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) + 14 > (inlength << 3)) return 49; /*error: the bit pointer is or will go past the memory*/
+  if(BitReader_bitpos(reader) + 14 > inbitlength) return 49; /*error: the bit pointer is or will go past the memory*/
 
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  BitReader_read(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = BitReader_read(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = BitReader_read(reader, 4) + 4;
 
-  if((*bp) + HCLEN * 3 > (inlength << 3)) return 50; /*error: the bit pointer is or will go past the memory*/
+  if(BitReader_bitpos(reader) + HCLEN * 3 > inbitlength) return 50; /*error: the bit pointer is or will go past the memory*/
 
   HuffmanTree_init(&tree_cl);
 
@@ -996,7 +1196,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i)
     {
-      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = BitReader_read(reader, 3);
       else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
@@ -1014,7 +1214,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     i = 0;
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code;
+      BitReader_refill(reader); /*enough for the code and its extra bits*/
+      code = huffmanDecodeSymbol(reader, &tree_cl);
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll[i] = code;
@@ -1028,8 +1230,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
         if (i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        if((*bp + 2) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 2);
+        replength += BitReader_peek(reader, 2);
+        BitReader_skip(reader, 2);
+        if(BitReader_overrun(reader)) ERROR_BREAK(50); /*error, bit pointer jumped past memory*/
 
         if(i < HLIT + 1) value = bitlen_ll[i - 1];
         else value = bitlen_d[i - HLIT - 1];
@@ -1045,8 +1248,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp + 3) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 3);
+        replength += BitReader_peek(reader, 3);
+        BitReader_skip(reader, 3);
+        if(BitReader_overrun(reader)) ERROR_BREAK(50); /*error, bit pointer jumped past memory*/
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1061,8 +1265,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp + 7) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 7);
+        replength += BitReader_peek(reader, 7);
+        BitReader_skip(reader, 7);
+        if(BitReader_overrun(reader)) ERROR_BREAK(50); /*error, bit pointer jumped past memory*/
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1080,7 +1285,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inbitlength ? 10 : 11;
+          error = BitReader_overrun(reader) ? 10 : 11;
         }
         else error = 16; /*unexisting code, this can never happen*/
         break;
@@ -1106,25 +1311,52 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
+/*When streaming to a sink, out only holds a sliding window: the last INFLATE_WINDOW bytes that distances can
+refer back to, plus up to INFLATE_FLUSH bytes that have not been written to the sink yet.*/
+#define INFLATE_WINDOW 32768
+#define INFLATE_FLUSH 32768
+
+/*write all but the last keep bytes of out to the sink and move those keep bytes to the front of out*/
+static unsigned inflateFlush(ucvector* out, size_t* pos, size_t keep, const InflateSink* sink)
+{
+  unsigned error;
+  size_t i, flushed;
+  if(*pos <= keep) return 0;
+  flushed = *pos - keep;
+  error = sink->write(sink->user, out->data, flushed);
+  if(error) return error;
+  for(i = 0; i != keep; ++i) out->data[i] = out->data[flushed + i];
+  *pos = keep;
+  out->size = keep;
+  return 0;
+}
+
 /*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+static unsigned inflateHuffmanBlock(ucvector* out, BitReader* reader,
+                                    size_t* pos, unsigned btype, const InflateSink* sink)
 {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
 
   if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
   while(!error) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll;
+    if(sink && *pos >= INFLATE_WINDOW + INFLATE_FLUSH)
+    {
+      error = inflateFlush(out, pos, INFLATE_WINDOW, sink);
+      if(error) break;
+    }
+    /*at most 15 + 5 + 15 + 13 bits for a length/distance pair, so one refill covers the whole symbol*/
+    BitReader_refill(reader);
+    code_ll = huffmanDecodeSymbol(reader, &tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
       /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
@@ -1143,18 +1375,19 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      length += BitReader_peek(reader, numextrabits_l);
+      BitReader_skip(reader, numextrabits_l);
+      if(BitReader_overrun(reader)) ERROR_BREAK(51); /*error, bit pointer jumped past memory*/
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, &tree_d);
       if(code_d > 29)
       {
         if(code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
+          error = BitReader_overrun(reader) ? 10 : 11;
         }
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
@@ -1163,8 +1396,9 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      distance += BitReader_peek(reader, numextrabits_d);
+      BitReader_skip(reader, numextrabits_d);
+      if(BitReader_overrun(reader)) ERROR_BREAK(51); /*error, bit pointer jumped past memory*/
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
       start = (*pos);
@@ -1188,7 +1422,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
       (10=no endcode, 11=wrong jump outside of tree)*/
-      error = ((*bp) > inlength * 8) ? 10 : 11;
+      error = BitReader_overrun(reader) ? 10 : 11;
       break;
     }
   }
@@ -1199,14 +1433,15 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, BitReader* reader, size_t* pos)
 {
   size_t p;
   unsigned LEN, NLEN, n, error = 0;
+  const unsigned char* in = reader->data;
+  size_t inlength = reader->size;
 
   /*go to first boundary of byte*/
-  while(((*bp) & 0x7) != 0) ++(*bp);
-  p = (*bp) / 8; /*byte position*/
+  p = BitReader_alignToByte(reader); /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
   if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
@@ -1222,35 +1457,36 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
   if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
   for(n = 0; n < LEN; ++n) out->data[(*pos)++] = in[p++];
 
-  (*bp) = p * 8;
+  BitReader_seekToByte(reader, p);
 
   return error;
 }
 
+/*inflate into out, or, if sink is not NULL, into a sliding window in out that is written to the sink as it fills*/
 static unsigned lodepng_inflatev(ucvector* out,
                                  const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings)
+                                 const LodePNGDecompressSettings* settings, const InflateSink* sink)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
+  BitReader reader;
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
 
   (void)settings;
+  BitReader_init(&reader, in, insize);
 
   while(!BFINAL)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1u * readBitFromStream(&bp, in);
-    BTYPE += 2u * readBitFromStream(&bp, in);
+    if(BitReader_bitpos(&reader) + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
+    BFINAL = BitReader_read(&reader, 1);
+    BTYPE = BitReader_read(&reader, 2);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(out, &reader, &pos, BTYPE, sink); /*compression, BTYPE 01 or 10*/
 
+    if(!error && sink) error = inflateFlush(out, &pos, BFINAL ? 0 : INFLATE_WINDOW, sink);
     if(error) return error;
   }
 
@@ -1264,7 +1500,9 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_inflatev(&v, in, insize, settings);
+  /*grow once to the expected size rather than in steps of 1.5 from whatever *out held*/
+  if(settings->expected_size && !ucvector_reserve(&v, *outsize + settings->expected_size)) return 83; /*alloc fail*/
+  error = lodepng_inflatev(&v, in, insize, settings, 0);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -1340,48 +1578,39 @@ static void addLengthDistance(uivector* values, size_t length, size_t distance)
   uivector_push_back(values, extra_distance);
 }
 
-/*3 bytes of data get encoded into two bytes. The hash cannot use more than 3
-bytes as input because 3 is the minimum match length for deflate*/
-static const unsigned HASH_NUM_VALUES = 65536;
-static const unsigned HASH_BIT_MASK = 65535; /*HASH_NUM_VALUES - 1, but C90 does not like that as initializer*/
+/*4 bytes of data are hashed into HASH_BITS bits. Matches of only 3 bytes are then not found (deflate allows
+them, but at the distances PNG data gives they rarely beat three literals), and the hash chains only hold
+positions that share 4 bytes, so far fewer candidates are compared than with a 3 byte hash.*/
+static const unsigned HASH_BITS = 15;
+static const unsigned HASH_NUM_VALUES = 32768; /*1 << HASH_BITS, but C90 does not like that as initializer*/
 
 typedef struct Hash
 {
-  int* head; /*hash value to head circular pos - can be outdated if went around window*/
-  /*circular pos to prev circular pos*/
+  /*hash value to the last position with that hash, stored as position - base + 1, 0 for none*/
+  unsigned* head;
+  /*position modulo the window size to the distance back to the previous position with the same hash,
+  0 for none within the window. Entries are only read for positions still in the window, which have
+  been written, so this needs no initialization.*/
   unsigned short* chain;
-  int* val; /*circular pos to hash value*/
-
-  /*TODO: do this not only for zeros but for any repeated byte. However for PNG
-  it's always going to be the zeros that dominate, so not important for PNG*/
-  int* headz; /*similar to head, but for chainz*/
-  unsigned short* chainz; /*those with same amount of zeros*/
-  unsigned short* zeros; /*length of zeros streak, used as a second hash chain*/
+  size_t base; /*input position that head entry 1 stands for*/
+  size_t next; /*first position not in the hash yet*/
 } Hash;
 
 static unsigned hash_init(Hash* hash, unsigned windowsize)
 {
   unsigned i;
-  hash->head = (int*)lodepng_malloc(sizeof(int) * HASH_NUM_VALUES);
-  hash->val = (int*)lodepng_malloc(sizeof(int) * windowsize);
+  hash->head = (unsigned*)lodepng_malloc(sizeof(unsigned) * HASH_NUM_VALUES);
   hash->chain = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
+  hash->base = 0;
+  hash->next = 0;
 
-  hash->zeros = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
-  hash->headz = (int*)lodepng_malloc(sizeof(int) * (MAX_SUPPORTED_DEFLATE_LENGTH + 1));
-  hash->chainz = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
-
-  if(!hash->head || !hash->chain || !hash->val  || !hash->headz|| !hash->chainz || !hash->zeros)
+  if(!hash->head || !hash->chain)
   {
     return 83; /*alloc fail*/
   }
 
-  /*initialize hash table*/
-  for(i = 0; i != HASH_NUM_VALUES; ++i) hash->head[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->val[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->chain[i] = i; /*same value as index indicates uninitialized*/
-
-  for(i = 0; i <= MAX_SUPPORTED_DEFLATE_LENGTH; ++i) hash->headz[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->chainz[i] = i; /*same value as index indicates uninitialized*/
+  /*only the heads are initialized, 128KB, so a small image doesn't pay for the window*/
+  for(i = 0; i != HASH_NUM_VALUES; ++i) hash->head[i] = 0;
 
   return 0;
 }
@@ -1389,58 +1618,90 @@ static unsigned hash_init(Hash* hash, unsigned windowsize)
 static void hash_cleanup(Hash* hash)
 {
   lodepng_free(hash->head);
-  lodepng_free(hash->val);
   lodepng_free(hash->chain);
+}
 
-  lodepng_free(hash->zeros);
-  lodepng_free(hash->headz);
-  lodepng_free(hash->chainz);
+/*4 bytes at data as a little endian number, assembled from bytes so any byte order and alignment works
+(compilers turn this into a single load)*/
+static unsigned readUint32LE(const unsigned char* data)
+{
+  return (unsigned)data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16) | ((unsigned)data[3] << 24);
 }
 
+static uint64_t readUint64LE(const unsigned char* data)
+{
+  return (uint64_t)readUint32LE(data) | ((uint64_t)readUint32LE(data + 4) << 32);
+}
 
+/*multiplicative hash of the 4 bytes at data: the top bits of the product depend on all of them*/
+static unsigned getHash(const unsigned char* data)
+{
+  return (readUint32LE(data) * 2654435761u) >> (32 - HASH_BITS);
+}
 
-static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
+/*add the positions up to and including pos to the hash, those with 4 bytes before insize*/
+static void updateHashChain(Hash* hash, const unsigned char* in, size_t pos, size_t insize, unsigned windowsize)
 {
-  unsigned result = 0;
-  if (pos + 2 < size)
+  if(pos + 4 > insize)
   {
-    /*A simple shift and xor hash is used. Since the data of PNGs is dominated
-    by zeroes due to the filters, a better hash does not have a significant
-    effect on speed in traversing the chain, and causes more time spend on
-    calculating the hash.*/
-    result ^= (unsigned)(data[pos + 0] << 0u);
-    result ^= (unsigned)(data[pos + 1] << 4u);
-    result ^= (unsigned)(data[pos + 2] << 8u);
-  } else {
-    size_t amount, i;
-    if(pos >= size) return 0;
-    amount = size - pos;
-    for(i = 0; i != amount; ++i) result ^= (unsigned)(data[pos + i] << (i * 8u));
+    if(insize < 4) return;
+    pos = insize - 4;
   }
-  return result & HASH_BIT_MASK;
-}
 
-static unsigned countZeros(const unsigned char* data, size_t size, size_t pos)
-{
-  const unsigned char* start = data + pos;
-  const unsigned char* end = start + MAX_SUPPORTED_DEFLATE_LENGTH;
-  if(end > data + size) end = data + size;
-  data = start;
-  while (data != end && *data == 0) ++data;
-  /*subtracting two addresses returned as 32-bit number (max value is MAX_SUPPORTED_DEFLATE_LENGTH)*/
-  return (unsigned)(data - start);
+  /*stored positions are 32-bit, so move the base up before they overflow (only for inputs over 2GB):
+  heads further back than the window are dropped anyway*/
+  if(pos - hash->base >= 0x7fffffffu)
+  {
+    size_t newbase = pos - windowsize;
+    unsigned i;
+    for(i = 0; i != HASH_NUM_VALUES; ++i)
+    {
+      size_t last = hash->base + hash->head[i] - 1;
+      hash->head[i] = hash->head[i] == 0 || last < newbase ? 0 : (unsigned)(last - newbase + 1);
+    }
+    hash->base = newbase;
+  }
+
+  for(; hash->next <= pos; ++hash->next)
+  {
+    unsigned hashval = getHash(&in[hash->next]);
+    unsigned last = hash->head[hashval];
+    size_t distance = last == 0 ? 0 : hash->next - (hash->base + last - 1);
+    hash->chain[hash->next & (windowsize - 1)] = (unsigned short)(distance < windowsize ? distance : 0);
+    hash->head[hashval] = (unsigned)(hash->next - hash->base + 1);
+  }
 }
 
-/*wpos = pos & (windowsize - 1)*/
-static void updateHashChain(Hash* hash, size_t wpos, unsigned hashval, unsigned short numzeros)
+/*the number of bytes from foreptr on that equal those from backptr on, compared 8 at a time: the lowest
+set bit of the xor of two little endian words is in the first byte that differs*/
+static unsigned matchLength(const unsigned char* foreptr, const unsigned char* backptr, const unsigned char* lastptr)
 {
-  hash->val[wpos] = (int)hashval;
-  if(hash->head[hashval] != -1) hash->chain[wpos] = hash->head[hashval];
-  hash->head[hashval] = wpos;
-
-  hash->zeros[wpos] = numzeros;
-  if(hash->headz[numzeros] != -1) hash->chainz[wpos] = hash->headz[numzeros];
-  hash->headz[numzeros] = wpos;
+  const unsigned char* start = foreptr;
+  while(lastptr - foreptr >= 8)
+  {
+    uint64_t diff = readUint64LE(foreptr) ^ readUint64LE(backptr);
+    if(diff != 0)
+    {
+#if defined(__GNUC__)
+      foreptr += __builtin_ctzll(diff) >> 3;
+#else
+      while((diff & 255) == 0)
+      {
+        diff >>= 8;
+        ++foreptr;
+      }
+#endif
+      return (unsigned)(foreptr - start);
+    }
+    foreptr += 8;
+    backptr += 8;
+  }
+  while(foreptr != lastptr && *backptr == *foreptr)
+  {
+    ++backptr;
+    ++foreptr;
+  }
+  return (unsigned)(foreptr - start);
 }
 
 /*
@@ -1450,114 +1711,78 @@ length/distance pairs.
 It uses a hash table technique to let it encode faster. When doing LZ77 encoding, a
 sliding window (of windowsize) is used, and all past bytes in that window can be used as
 the "dictionary". A brute force search through all possible distances would be slow, and
-this hash technique is one out of several ways to speed this up.
+this hash technique is one out of several ways to speed this up: only the earlier positions
+that start with the same 4 bytes are tried, most recent first, up to a number that grows with
+the window size.
 */
 static unsigned encodeLZ77(uivector* out, Hash* hash,
                            const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
                            unsigned minmatch, unsigned nicematch, unsigned lazymatching)
 {
   size_t pos;
-  unsigned i, error = 0;
-  /*for large window lengths, assume the user wants no compression loss. Otherwise, max hash chain length speedup.*/
-  unsigned maxchainlength = windowsize >= 8192 ? windowsize : windowsize / 8;
+  unsigned error = 0;
+  /*the longest hash chain followed: an eighth of the window, and at most zlib's bound for its best level,
+  so the largest windows no longer search every position*/
+  unsigned maxchainlength = windowsize >= 8192 ? 4096 : windowsize / 8;
   unsigned maxlazymatch = windowsize >= 8192 ? MAX_SUPPORTED_DEFLATE_LENGTH : 64;
 
-  unsigned usezeros = 1; /*not sure if setting it to false for windowsize < 8192 is better or worse*/
-  unsigned numzeros = 0;
-
   unsigned offset; /*the offset represents the distance in LZ77 terminology*/
   unsigned length;
   unsigned lazy = 0;
   unsigned lazylength = 0, lazyoffset = 0;
-  unsigned hashval;
   unsigned current_offset, current_length;
-  unsigned prev_offset;
+  unsigned chainlength;
+  size_t available, hashpos;
   const unsigned char *lastptr, *foreptr, *backptr;
-  unsigned hashpos;
 
   if(windowsize == 0 || windowsize > 32768) return 60; /*error: windowsize smaller/larger than allowed*/
   if((windowsize & (windowsize - 1)) != 0) return 90; /*error: must be power of two*/
 
   if(nicematch > MAX_SUPPORTED_DEFLATE_LENGTH) nicematch = MAX_SUPPORTED_DEFLATE_LENGTH;
+  if(maxchainlength == 0) maxchainlength = 1;
 
   for(pos = inpos; pos < insize; ++pos)
   {
-    size_t wpos = pos & (windowsize - 1); /*position for in 'circular' hash buffers*/
-    unsigned chainlength = 0;
-
-    hashval = getHash(in, insize, pos);
-
-    if(usezeros && hashval == 0)
-    {
-      if (numzeros == 0) numzeros = countZeros(in, insize, pos);
-      else if (pos + numzeros > insize || in[pos + numzeros - 1] != 0) --numzeros;
-    }
-    else
-    {
-      numzeros = 0;
-    }
-
-    updateHashChain(hash, wpos, hashval, numzeros);
-
     /*the length and offset found for the current position*/
     length = 0;
     offset = 0;
 
-    hashpos = hash->chain[wpos];
+    available = insize - pos;
+    if(available > MAX_SUPPORTED_DEFLATE_LENGTH) available = MAX_SUPPORTED_DEFLATE_LENGTH;
+    foreptr = &in[pos];
+    lastptr = foreptr + available;
 
-    lastptr = &in[insize < pos + MAX_SUPPORTED_DEFLATE_LENGTH ? insize : pos + MAX_SUPPORTED_DEFLATE_LENGTH];
-
-    /*search for the longest string*/
-    prev_offset = 0;
-    for(;;)
+    /*search for the longest string, among the positions before this one with the same hash*/
+    if(available >= 4)
     {
-      if(chainlength++ >= maxchainlength) break;
-      current_offset = hashpos <= wpos ? wpos - hashpos : wpos - hashpos + windowsize;
-
-      if(current_offset < prev_offset) break; /*stop when went completely around the circular buffer*/
-      prev_offset = current_offset;
-      if(current_offset > 0)
+      if(hash->next < pos) updateHashChain(hash, in, pos - 1, insize, windowsize);
+      hashpos = hash->head[getHash(foreptr)];
+      hashpos = hashpos == 0 ? pos : hash->base + hashpos - 1;
+      chainlength = 0;
+      while(hashpos < pos && chainlength++ < maxchainlength)
       {
-        /*test the next characters*/
-        foreptr = &in[pos];
-        backptr = &in[pos - current_offset];
-
-        /*common case in PNGs is lots of zeros. Quickly skip over them as a speedup*/
-        if(numzeros >= 3)
-        {
-          unsigned skip = hash->zeros[hashpos];
-          if(skip > numzeros) skip = numzeros;
-          backptr += skip;
-          foreptr += skip;
-        }
-
-        while(foreptr != lastptr && *backptr == *foreptr) /*maximum supported length by deflate is max length*/
-        {
-          ++backptr;
-          ++foreptr;
-        }
-        current_length = (unsigned)(foreptr - &in[pos]);
+        current_offset = (unsigned)(pos - hashpos);
+        if(current_offset >= windowsize) break;
+        backptr = &in[hashpos];
 
-        if(current_length > length)
+        /*only a candidate that also matches the byte after the longest match so far can be longer*/
+        if(backptr[length] == foreptr[length])
         {
-          length = current_length; /*the longest length*/
-          offset = current_offset; /*the offset that is related to this longest length*/
-          /*jump out once a length of max length is found (speed gain). This also jumps
-          out if length is MAX_SUPPORTED_DEFLATE_LENGTH*/
-          if(current_length >= nicematch) break;
+          current_length = matchLength(foreptr, backptr, lastptr);
+          if(current_length > length)
+          {
+            length = current_length; /*the longest length*/
+            offset = current_offset; /*the offset that is related to this longest length*/
+            /*jump out once a length of max length is found (speed gain). This also jumps
+            out if length is MAX_SUPPORTED_DEFLATE_LENGTH or the end of the input*/
+            if(length >= nicematch || length == available) break;
+          }
         }
-      }
-
-      if(hashpos == hash->chain[hashpos]) break;
 
-      if(numzeros >= 3 && length > numzeros) {
-        hashpos = hash->chainz[hashpos];
-        if(hash->zeros[hashpos] != numzeros) break;
-      } else {
-        hashpos = hash->chain[hashpos];
-        /*outdated hash value, happens if particular value was not encountered in whole last window*/
-        if(hash->val[hashpos] != (int)hashval) break;
+        if(hash->chain[hashpos & (windowsize - 1)] == 0) break;
+        hashpos -= hash->chain[hashpos & (windowsize - 1)];
       }
+      updateHashChain(hash, in, pos, insize, windowsize);
     }
 
     if(lazymatching)
@@ -1580,10 +1805,9 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
         }
         else
         {
+          /*the match found at the previous byte it is, the hash already has this one*/
           length = lazylength;
           offset = lazyoffset;
-          hash->head[hashval] = -1; /*the same hashchain update will be done, this ensures no wrong alteration*/
-          hash->headz[numzeros] = -1; /*idem*/
           --pos;
         }
       }
@@ -1603,23 +1827,9 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
     }
     else
     {
+      /*the bytes the match covers go into the hash when the search at the next position starts*/
       addLengthDistance(out, length, offset);
-      for(i = 1; i < length; ++i)
-      {
-        ++pos;
-        wpos = pos & (windowsize - 1);
-        hashval = getHash(in, insize, pos);
-        if(usezeros && hashval == 0)
-        {
-          if (numzeros == 0) numzeros = countZeros(in, insize, pos);
-          else if (pos + numzeros > insize || in[pos + numzeros - 1] != 0) --numzeros;
-        }
-        else
-        {
-          numzeros = 0;
-        }
-        updateHashChain(hash, wpos, hashval, numzeros);
-      }
+      pos += length - 1;
     }
   } /*end of the loop through each character of input*/
 
@@ -1628,26 +1838,27 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned final)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
-  2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
+  2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA. No data still takes one, empty, block.*/
 
   size_t i, j, numdeflateblocks = (datasize + 65534) / 65535;
-  unsigned datapos = 0;
+  size_t datapos = 0;
+  if(numdeflateblocks == 0) numdeflateblocks = 1;
   for(i = 0; i != numdeflateblocks; ++i)
   {
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
     ucvector_push_back(out, firstbyte);
 
     LEN = 65535;
-    if(datasize - datapos < 65535) LEN = (unsigned)datasize - datapos;
+    if(datasize - datapos < 65535) LEN = (unsigned)(datasize - datapos);
     NLEN = 65535 - LEN;
 
     ucvector_push_back(out, (unsigned char)(LEN % 256));
@@ -1699,7 +1910,7 @@ static void writeLZ77data(size_t* bp, ucvector* out, const uivector* lz77_encode
 }
 
 /*Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees*/
-static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
+static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash, uivector* lz77_encoded,
                                const unsigned char* data, size_t datapos, size_t dataend,
                                const LodePNGCompressSettings* settings, unsigned final)
 {
@@ -1716,8 +1927,6 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   the code length code lengths ("clcl").
   */
 
-  /*The lz77 encoded data, represented with integers since there will also be length and distance codes in it*/
-  uivector lz77_encoded;
   HuffmanTree tree_ll; /*tree for lit,len values*/
   HuffmanTree tree_d; /*tree for distance codes*/
   HuffmanTree tree_cl; /*tree for encoding the code lengths representing tree_ll and tree_d*/
@@ -1743,7 +1952,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   size_t numcodes_ll, numcodes_d, i;
   unsigned HLIT, HDIST, HCLEN;
 
-  uivector_init(&lz77_encoded);
+  lz77_encoded->size = 0; /*the buffer of the previous block, reused*/
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
   HuffmanTree_init(&tree_cl);
@@ -1760,27 +1969,27 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   {
     if(settings->use_lz77)
     {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
+      error = encodeLZ77(lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
                          settings->minmatch, settings->nicematch, settings->lazymatching);
       if(error) break;
     }
     else
     {
-      if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
-      for(i = datapos; i < dataend; ++i) lz77_encoded.data[i] = data[i]; /*no LZ77, but still will be Huffman compressed*/
+      if(!uivector_resize(lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
+      for(i = datapos; i < dataend; ++i) lz77_encoded->data[i - datapos] = data[i]; /*no LZ77, but still will be Huffman compressed*/
     }
 
     if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(83 /*alloc fail*/);
     if(!uivector_resizev(&frequencies_d, 30, 0)) ERROR_BREAK(83 /*alloc fail*/);
 
     /*Count the frequencies of lit, len and dist codes*/
-    for(i = 0; i != lz77_encoded.size; ++i)
+    for(i = 0; i != lz77_encoded->size; ++i)
     {
-      unsigned symbol = lz77_encoded.data[i];
+      unsigned symbol = lz77_encoded->data[i];
       ++frequencies_ll.data[symbol];
       if(symbol > 256)
       {
-        unsigned dist = lz77_encoded.data[i + 2];
+        unsigned dist = lz77_encoded->data[i + 2];
         ++frequencies_d.data[dist];
         i += 3;
       }
@@ -1919,7 +2128,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     }
 
     /*write the compressed data symbols*/
-    writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
+    writeLZ77data(bp, out, lz77_encoded, &tree_ll, &tree_d);
     /*error: the length of the end code 256 must be larger than 0*/
     if(HuffmanTree_getLength(&tree_ll, 256) == 0) ERROR_BREAK(64);
 
@@ -1930,7 +2139,6 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   }
 
   /*cleanup*/
-  uivector_cleanup(&lz77_encoded);
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
   HuffmanTree_cleanup(&tree_cl);
@@ -1944,7 +2152,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
-static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
+static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash, uivector* lz77_encoded,
                              const unsigned char* data,
                              size_t datapos, size_t dataend,
                              const LodePNGCompressSettings* settings, unsigned final)
@@ -1968,12 +2176,10 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
 
   if(settings->use_lz77) /*LZ77 encoded*/
   {
-    uivector lz77_encoded;
-    uivector_init(&lz77_encoded);
-    error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
+    lz77_encoded->size = 0;
+    error = encodeLZ77(lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
                        settings->minmatch, settings->nicematch, settings->lazymatching);
-    if(!error) writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
-    uivector_cleanup(&lz77_encoded);
+    if(!error) writeLZ77data(bp, out, lz77_encoded, &tree_ll, &tree_d);
   }
   else /*no LZ77, but still will be Huffman compressed*/
   {
@@ -1992,17 +2198,26 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
-static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings)
+/*
+deflate in[start, end) as blocks of a stream over all of in: the hash starts with the window before start, so
+matches can reach back into it. Only with final does the last block have BFINAL set, else the blocks end with an
+empty stored block, which brings them to a byte boundary as zlib's Z_SYNC_FLUSH does.
+*/
+static unsigned deflateRange(ucvector* out, const unsigned char* in, size_t start, size_t end, unsigned final,
+                             const LodePNGCompressSettings* settings)
 {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
+  size_t insize = end - start;
   size_t bp = 0; /*the bit pointer*/
   Hash hash;
+  /*The lz77 encoded data, represented with integers since there will also be length and distance codes in it.
+  One buffer for all the blocks*/
+  uivector lz77_encoded;
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
-  else if(settings->btype == 1) blocksize = insize;
+  else if(settings->btype == 0) return deflateNoCompression(out, &in[start], insize, final);
+  else if(settings->btype == 1) blocksize = insize ? insize : 1; /*one block, which for no data is empty*/
   else /*if(settings->btype == 2)*/
   {
     blocksize = insize / 8 + 8;
@@ -2015,17 +2230,40 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   error = hash_init(&hash, settings->windowsize);
   if(error) return error;
 
+  /*the positions of the window before start, which an earlier part of the stream holds*/
+  if(start > 0 && settings->use_lz77)
+  {
+    hash.base = hash.next = start > settings->windowsize ? start - settings->windowsize : 0;
+    updateHashChain(&hash, in, start - 1, end, settings->windowsize);
+  }
+
+  /*reserved for a block of literals, one value per byte: length/distance pairs take 4 values but cover at
+  least 3 bytes and usually many more, so only data full of short matches makes it grow*/
+  uivector_init(&lz77_encoded);
+  if(!uivector_reserve(&lz77_encoded, (blocksize < insize ? blocksize : insize) * sizeof(unsigned))) error = 83; /*alloc fail*/
+
   for(i = 0; i != numdeflateblocks && !error; ++i)
   {
-    unsigned final = (i == numdeflateblocks - 1);
-    size_t start = i * blocksize;
-    size_t end = start + blocksize;
-    if(end > insize) end = insize;
+    unsigned last = (i == numdeflateblocks - 1);
+    size_t blockstart = start + i * blocksize;
+    size_t blockend = blockstart + blocksize;
+    if(blockend > end) blockend = end;
+
+    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, &lz77_encoded, in, blockstart, blockend, settings, final && last);
+    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, &lz77_encoded, in, blockstart, blockend, settings, final && last);
+  }
 
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+  if(!error && !final)
+  {
+    /*BFINAL 0 and BTYPE 00, then LEN 0 and NLEN 0xffff from the next byte on*/
+    addBitsToStream(&bp, out, 0, 3);
+    ucvector_push_back(out, 0);
+    ucvector_push_back(out, 0);
+    ucvector_push_back(out, 255);
+    ucvector_push_back(out, 255);
   }
 
+  uivector_cleanup(&lz77_encoded);
   hash_cleanup(&hash);
 
   return error;
@@ -2038,7 +2276,19 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_deflatev(&v, in, insize, settings);
+  error = deflateRange(&v, in, 0, insize, 1, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+unsigned lodepng_deflate_part(unsigned char** out, size_t* outsize, const unsigned char* in,
+                              size_t start, size_t end, unsigned final, const LodePNGCompressSettings* settings)
+{
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = deflateRange(&v, in, start, end, final, settings);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -2064,7 +2314,15 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
+/*
+The Adler32 of every zlib stream, over all the inflated (or deflated) bytes. s1 and s2 only need the modulo every
+5552 bytes (NMAX in zlib), the most bytes after which s2 still fits in 32 bits. The vector versions take 32 (SSSE3)
+or 16 (NEON) bytes at a time: s1 gets the sum of the bytes, s2 the bytes weighted by their distance to the end of
+the block, plus the block size times the s1 before the block. The portable version is used for the tail.
+*/
+typedef unsigned (*Adler32Kernel)(unsigned adler, const unsigned char* data, unsigned len);
+
+static unsigned update_adler32Scalar(unsigned adler, const unsigned char* data, unsigned len)
 {
    unsigned s1 = adler & 0xffff;
    unsigned s2 = (adler >> 16) & 0xffff;
@@ -2087,22 +2345,163 @@ static unsigned update_adler32(unsigned adler, const unsigned char* data, unsign
   return (s2 << 16) | s1;
 }
 
+#ifdef LODEPNG_SIMD_X86
+LODEPNG_TARGET_SSSE3
+static unsigned update_adler32SSSE3(unsigned adler, const unsigned char* data, unsigned len)
+{
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / 32;
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+
+  len -= blocks * 32;
+  while(blocks > 0)
+  {
+    unsigned n = blocks < 5552 / 32 ? blocks : 5552 / 32;
+    /*v_ps: the s1 before each block, summed over the blocks*/
+    __m128i v_ps = _mm_cvtsi32_si128((int)(s1 * n));
+    __m128i v_s1 = zero;
+    __m128i v_s2 = _mm_cvtsi32_si128((int)s2);
+    blocks -= n;
+    do
+    {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      data += 32;
+    }
+    while(--n);
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 += (unsigned)_mm_cvtsi128_si32(v_s1);
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s2 = (unsigned)_mm_cvtsi128_si32(v_s2);
+    s1 %= 65521;
+    s2 %= 65521;
+  }
+
+  return update_adler32Scalar((s2 << 16) | s1, data, len);
+}
+#endif /*LODEPNG_SIMD_X86*/
+
+#ifdef LODEPNG_SIMD_NEON
+static unsigned update_adler32NEON(unsigned adler, const unsigned char* data, unsigned len)
+{
+  static const uint16_t taps[16] = { 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 };
+  const uint16x8_t tap_lo = vld1q_u16(taps);
+  const uint16x8_t tap_hi = vld1q_u16(taps + 8);
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / 16;
+
+  len -= blocks * 16;
+  while(blocks > 0)
+  {
+    /*at most 256 blocks, so the 16-bit column sums can't overflow*/
+    unsigned n = blocks < 256 ? blocks : 256;
+    unsigned ps = s1 * n;
+    uint32x4_t v_ps = vdupq_n_u32(0);
+    uint32x4_t v_s1 = vdupq_n_u32(0);
+    uint32x4_t v_s2;
+    uint16x8_t col_lo = vdupq_n_u16(0);
+    uint16x8_t col_hi = vdupq_n_u16(0);
+    blocks -= n;
+    do
+    {
+      uint8x16_t bytes = vld1q_u8(data);
+      v_ps = vaddq_u32(v_ps, v_s1);
+      v_s1 = vpadalq_u16(v_s1, vpaddlq_u8(bytes));
+      col_lo = vaddw_u8(col_lo, vget_low_u8(bytes));
+      col_hi = vaddw_u8(col_hi, vget_high_u8(bytes));
+      data += 16;
+    }
+    while(--n);
+    v_s2 = vshlq_n_u32(v_ps, 4);
+    v_s2 = vmlal_u16(v_s2, vget_low_u16(col_lo), vget_low_u16(tap_lo));
+    v_s2 = vmlal_u16(v_s2, vget_high_u16(col_lo), vget_high_u16(tap_lo));
+    v_s2 = vmlal_u16(v_s2, vget_low_u16(col_hi), vget_low_u16(tap_hi));
+    v_s2 = vmlal_u16(v_s2, vget_high_u16(col_hi), vget_high_u16(tap_hi));
+    s2 += (ps << 4) + vaddvq_u32(v_s2);
+    s1 += vaddvq_u32(v_s1);
+    s1 %= 65521;
+    s2 %= 65521;
+  }
+
+  return update_adler32Scalar((s2 << 16) | s1, data, len);
+}
+#endif /*LODEPNG_SIMD_NEON*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
+{
+  static Adler32Kernel selected = 0;
+  if(!selected)
+  {
+#if defined(LODEPNG_SIMD_X86)
+    __builtin_cpu_init();
+    selected = __builtin_cpu_supports("ssse3") ? update_adler32SSSE3 : update_adler32Scalar;
+#elif defined(LODEPNG_SIMD_NEON)
+    selected = update_adler32NEON;
+#else
+    selected = update_adler32Scalar;
+#endif
+  }
+  return selected(adler, data, len);
+}
+
 /*Return the adler32 of the bytes data[0..len-1]*/
 static unsigned adler32(const unsigned char* data, unsigned len)
 {
   return update_adler32(1L, data, len);
 }
 
+unsigned lodepng_adler32(const unsigned char* data, size_t len)
+{
+  unsigned adler = 1;
+  while(len > 0)
+  {
+    unsigned chunk = len > 0x40000000u ? 0x40000000u : (unsigned)len;
+    adler = update_adler32(adler, data, chunk);
+    data += chunk;
+    len -= chunk;
+  }
+  return adler;
+}
+
+/*as zlib's adler32_combine: going len2 bytes further adds len2 * s1 to s2, and the second sums without their
+starting values (s1 1, s2 0) add to the first*/
+unsigned lodepng_adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  const unsigned base = 65521;
+  unsigned rem = (unsigned)(len2 % base);
+  unsigned s1 = adler1 & 0xffff;
+  unsigned s2 = (unsigned)(((uint64_t)rem * s1) % base);
+  s1 += (adler2 & 0xffff) + base - 1;
+  s2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+  if(s1 >= base) s1 -= base;
+  if(s1 >= base) s1 -= base;
+  if(s2 >= base * 2) s2 -= base * 2;
+  if(s2 >= base) s2 -= base;
+  return s1 | (s2 << 16);
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                 size_t insize, const LodePNGDecompressSettings* settings)
+/*check the 2 byte zlib header at the start of in*/
+static unsigned zlib_check_header(const unsigned char* in, size_t insize)
 {
-  unsigned error = 0;
   unsigned CM, CINFO, FDICT;
 
   if(insize < 2) return 53; /*error, size of zlib data too small*/
@@ -2131,6 +2530,15 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
     return 26;
   }
 
+  return 0;
+}
+
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error = zlib_check_header(in, insize);
+  if(error) return error;
+
   error = inflate(out, outsize, in + 2, insize - 2, settings);
   if(error) return error;
 
@@ -2157,6 +2565,64 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   }
 }
 
+/*adds the adler32 of the data that passes through to the next sink*/
+typedef struct AdlerSink
+{
+  const InflateSink* next;
+  unsigned adler;
+  unsigned check;
+} AdlerSink;
+
+static unsigned adlerSinkWrite(void* user, const unsigned char* data, size_t size)
+{
+  AdlerSink* s = (AdlerSink*)user;
+  if(s->check) s->adler = update_adler32(s->adler, data, (unsigned)size);
+  return s->next->write(s->next->user, data, size);
+}
+
+/*decompress into the sink with a sliding window of memory instead of a buffer for all the output. Custom
+zlib or inflate functions only work on whole buffers, with those the output is passed on in one piece.*/
+static unsigned zlib_decompress_sink(const unsigned char* in, size_t insize,
+                                     const LodePNGDecompressSettings* settings, const InflateSink* sink)
+{
+  unsigned error;
+  ucvector window;
+  AdlerSink adler;
+  InflateSink adlersink;
+
+  if(settings->custom_zlib || settings->custom_inflate)
+  {
+    unsigned char* out = 0;
+    size_t outsize = 0;
+    error = zlib_decompress(&out, &outsize, in, insize, settings);
+    if(!error) error = sink->write(sink->user, out, outsize);
+    lodepng_free(out);
+    return error;
+  }
+
+  error = zlib_check_header(in, insize);
+  if(error) return error;
+
+  adler.next = sink;
+  adler.adler = 1;
+  adler.check = !settings->ignore_adler32;
+  adlersink.write = adlerSinkWrite;
+  adlersink.user = &adler;
+
+  ucvector_init(&window);
+  if(!ucvector_reserve(&window, INFLATE_WINDOW + INFLATE_FLUSH + 65536)) error = 83; /*alloc fail*/
+  if(!error) error = lodepng_inflatev(&window, in + 2, insize - 2, settings, &adlersink);
+  ucvector_cleanup(&window);
+  if(error) return error;
+
+  if(adler.check)
+  {
+    if(insize < 6) return 53; /*error, size of zlib data too small*/
+    if(adler.adler != lodepng_read32bitInt(&in[insize - 4])) return 58; /*error, adler checksum not correct*/
+  }
+  return 0;
+}
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -2227,6 +2693,18 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   if (!settings->custom_zlib) return 87; /*no custom zlib function provided */
   return settings->custom_zlib(out, outsize, in, insize, settings);
 }
+
+static unsigned zlib_decompress_sink(const unsigned char* in, size_t insize,
+                                     const LodePNGDecompressSettings* settings, const InflateSink* sink)
+{
+  unsigned error;
+  unsigned char* out = 0;
+  size_t outsize = 0;
+  error = zlib_decompress(&out, &outsize, in, insize, settings);
+  if(!error) error = sink->write(sink->user, out, outsize);
+  lodepng_free(out);
+  return error;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 #ifdef LODEPNG_COMPILE_ENCODER
 static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
@@ -2275,9 +2753,10 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings)
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+  settings->expected_size = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -2329,20 +2808,147 @@ static unsigned lodepng_crc32_table[256] = {
   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
 };
 
-/*Return the CRC of the bytes buf[0..len-1].*/
-unsigned lodepng_crc32(const unsigned char* buf, size_t len)
+/*
+lodepng_crc32_slices[k - 1][n] is the CRC register after byte n followed by k zero bytes, so that 8 bytes can be
+taken with 8 independent lookups (slice-by-8), filled in on first use from lodepng_crc32_table.
+With PCLMULQDQ (x86) the bulk of a chunk is folded 64 bytes at a time with carry-less multiplies and then
+reduced to 32 bits (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"), the
+tail goes through the tables. On 64-bit ARM the CRC32 instructions are used when the compiler targets them.
+All of them update the CRC register, without the inversions at the start and the end.
+*/
+typedef unsigned (*Crc32Kernel)(unsigned c, const unsigned char* buf, size_t len);
+
+static unsigned lodepng_crc32_slices[7][256];
+
+static unsigned crc32Bytes(unsigned c, const unsigned char* buf, size_t len)
 {
-  unsigned c = 0xffffffffL;
   size_t n;
-
   for(n = 0; n < len; ++n)
   {
     c = lodepng_crc32_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
   }
-  return c ^ 0xffffffffL;
+  return c;
 }
 
-/* ////////////////////////////////////////////////////////////////////////// */
+static unsigned crc32Slice8(unsigned c, const unsigned char* buf, size_t len)
+{
+  for(; len >= 8; buf += 8, len -= 8)
+  {
+    c ^= (unsigned)buf[0] | ((unsigned)buf[1] << 8) | ((unsigned)buf[2] << 16) | ((unsigned)buf[3] << 24);
+    c = lodepng_crc32_slices[6][c & 0xff] ^ lodepng_crc32_slices[5][(c >> 8) & 0xff]
+      ^ lodepng_crc32_slices[4][(c >> 16) & 0xff] ^ lodepng_crc32_slices[3][c >> 24]
+      ^ lodepng_crc32_slices[2][buf[4]] ^ lodepng_crc32_slices[1][buf[5]]
+      ^ lodepng_crc32_slices[0][buf[6]] ^ lodepng_crc32_table[buf[7]];
+  }
+  return crc32Bytes(c, buf, len);
+}
+
+#ifdef LODEPNG_SIMD_X86
+/*fold the 128-bit x over 128 bits further, into next; k holds the two 33-bit constants for that distance*/
+LODEPNG_TARGET_PCLMUL static __m128i crc32Fold(__m128i x, __m128i k, __m128i next)
+{
+  return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next);
+}
+
+/*the bit-reflected constants x^(n) mod P for the folding distances, and P and its Barrett constant*/
+#define LODEPNG_CRC32_K(hi1, hi0, lo1, lo0) _mm_set_epi32((int)(hi1), (int)(hi0), (int)(lo1), (int)(lo0))
+
+LODEPNG_TARGET_PCLMUL
+static unsigned crc32PCLMUL(unsigned c, const unsigned char* buf, size_t len)
+{
+  __m128i x1, x2, x3, x4, k, mask;
+  if(len < 64) return crc32Slice8(c, buf, len);
+
+  x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)buf), _mm_cvtsi32_si128((int)c));
+  x2 = _mm_loadu_si128((const __m128i*)(buf + 16));
+  x3 = _mm_loadu_si128((const __m128i*)(buf + 32));
+  x4 = _mm_loadu_si128((const __m128i*)(buf + 48));
+  buf += 64;
+  len -= 64;
+
+  /*four lanes of 128 bits, each folded over 512 bits*/
+  k = LODEPNG_CRC32_K(0x00000001u, 0xc6e41596u, 0x00000001u, 0x54442bd4u);
+  for(; len >= 64; buf += 64, len -= 64)
+  {
+    x1 = crc32Fold(x1, k, _mm_loadu_si128((const __m128i*)buf));
+    x2 = crc32Fold(x2, k, _mm_loadu_si128((const __m128i*)(buf + 16)));
+    x3 = crc32Fold(x3, k, _mm_loadu_si128((const __m128i*)(buf + 32)));
+    x4 = crc32Fold(x4, k, _mm_loadu_si128((const __m128i*)(buf + 48)));
+  }
+
+  /*the lanes into one, then the remaining whole 16 bytes*/
+  k = LODEPNG_CRC32_K(0x00000000u, 0xccaa009eu, 0x00000001u, 0x751997d0u);
+  x1 = crc32Fold(x1, k, x2);
+  x1 = crc32Fold(x1, k, x3);
+  x1 = crc32Fold(x1, k, x4);
+  for(; len >= 16; buf += 16, len -= 16) x1 = crc32Fold(x1, k, _mm_loadu_si128((const __m128i*)buf));
+
+  /*128 to 64 bits*/
+  mask = _mm_setr_epi32(-1, 0, -1, 0);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k, 0x10));
+  k = LODEPNG_CRC32_K(0x00000000u, 0x00000000u, 0x00000001u, 0x63cd6124u);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 4), _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00));
+
+  /*Barrett reduction to 32 bits*/
+  k = LODEPNG_CRC32_K(0x00000001u, 0xf7011641u, 0x00000001u, 0xdb710641u);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  c = (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+  return crc32Slice8(c, buf, len);
+}
+
+#undef LODEPNG_CRC32_K
+#endif /*LODEPNG_SIMD_X86*/
+
+#if defined(LODEPNG_SIMD_NEON) && defined(__ARM_FEATURE_CRC32)
+static unsigned crc32ARM(unsigned c, const unsigned char* buf, size_t len)
+{
+  for(; len >= 8; buf += 8, len -= 8)
+  {
+    uint64_t word = 0;
+    unsigned i;
+    for(i = 0; i != 8; ++i) word |= (uint64_t)buf[i] << (i * 8);
+    c = __crc32d(c, word);
+  }
+  for(; len > 0; ++buf, --len) c = __crc32b(c, *buf);
+  return c;
+}
+#endif /*LODEPNG_SIMD_NEON && __ARM_FEATURE_CRC32*/
+
+static Crc32Kernel crc32Kernel(void)
+{
+  static Crc32Kernel selected = 0;
+  unsigned k, n;
+  if(selected) return selected;
+  for(n = 0; n != 256; ++n)
+  {
+    unsigned c = lodepng_crc32_table[n];
+    for(k = 0; k != 7; ++k)
+    {
+      c = lodepng_crc32_table[c & 0xff] ^ (c >> 8);
+      lodepng_crc32_slices[k][n] = c;
+    }
+  }
+#if defined(LODEPNG_SIMD_X86)
+  __builtin_cpu_init();
+  selected = __builtin_cpu_supports("pclmul") ? crc32PCLMUL : crc32Slice8;
+#elif defined(LODEPNG_SIMD_NEON) && defined(__ARM_FEATURE_CRC32)
+  selected = crc32ARM;
+#else
+  selected = crc32Slice8;
+#endif
+  return selected;
+}
+
+/*Return the CRC of the bytes buf[0..len-1].*/
+unsigned lodepng_crc32(const unsigned char* buf, size_t len)
+{
+  return crc32Kernel()(0xffffffffL, buf, len) ^ 0xffffffffL;
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
 /* / Reading and writing single bits and bytes from/to stream for LodePNG   / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
@@ -2511,6 +3117,760 @@ unsigned lodepng_chunk_create(unsigned char** out, size_t* outlength, unsigned l
   return 0;
 }
 
+/*
+Paeth predicter, used by PNG filter type 4
+The parameters are of type short, but should come from unsigned chars, the shorts
+are only needed to make the paeth calculation correct.
+*/
+static unsigned char paethPredictor(short a, short b, short c)
+{
+  short pa = abs(b - c);
+  short pb = abs(a - c);
+  short pc = abs(a + b - c - c);
+
+  if(pc < pa && pc < pb) return (unsigned char)c;
+  else if(pb < pa) return (unsigned char)b;
+  else return (unsigned char)a;
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Pixel kernels                                                          / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*
+Kernels for the loops over every byte of an image, one set per instruction set, chosen once by
+pixelKernels(). They give the same bytes as the portable code.
+
+Unfiltering of 3 and 4 byte per pixel scanlines, the common RGB8 and RGBA8 camera images (Up: any pixel size).
+Up has no dependency between bytes and runs 16 bytes at a time. Sub adds up the pixels of a vector with
+two shifted adds (a prefix sum over the pixel lanes) and carries in the last pixel of the previous vector.
+Average and Paeth depend on the pixel just reconstructed, so they run a pixel at a time, with the bytes
+of a pixel in 16-bit lanes and the Paeth choice made by compares and masks instead of branches.
+Like unfilterScanline these work when recon and scanline are the same memory, or recon starts before
+scanline, since every byte of scanline is loaded before any store can reach it. precon is never null here.
+The portable set has no unfiltering kernels, unfilterScanline then uses its own loops.
+
+Color conversion between the common 8-bit color types, for lodepng_convert and lodepng_convert_planes,
+with byte shuffles where the instruction set has them.
+
+The filter costs of LFS_MINSUM: all five filters of a scanline in one pass, 16 bytes at a time, without
+writing any of them. Only the sums are kept, per filter in 64-bit lanes (the sum of absolute differences
+against zero adds up 8 bytes at once), and they are the same as those of the portable loop.
+*/
+typedef struct PixelKernels
+{
+  void (*sub)(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length);
+  void (*up)(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t length);
+  void (*average)(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                  size_t bytewidth, size_t length);
+  void (*paeth)(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                size_t bytewidth, size_t length);
+
+  /*RGB8 to RGBA8 with opaque alpha*/
+  void (*rgbToRgba)(unsigned char* out, const unsigned char* in, size_t numpixels);
+  /*RGBA8 to RGB8, dropping alpha*/
+  void (*rgbaToRgb)(unsigned char* out, const unsigned char* in, size_t numpixels);
+  /*GREY8 to RGBA8 with opaque alpha*/
+  void (*greyToRgba)(unsigned char* out, const unsigned char* in, size_t numpixels);
+  /*out[i] = in[i * stride + offset] for count bytes, offset < stride: one channel of an interleaved image,
+  or the high bytes of 16-bit values*/
+  void (*extract)(unsigned char* out, const unsigned char* in, size_t count, size_t stride, size_t offset);
+
+  /*sums[type] = the LFS_MINSUM cost of filtering scanline with each of the five filter types (see
+  filterSumsScalar); prevline is null for the first row*/
+  void (*filterSums)(size_t* sums, const unsigned char* scanline, const unsigned char* prevline,
+                     size_t bytewidth, size_t length);
+} PixelKernels;
+
+static void rgbToRgbaScalar(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i;
+  for(i = 0; i != numpixels; ++i, out += 4, in += 3)
+  {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+    out[3] = 255;
+  }
+}
+
+static void rgbaToRgbScalar(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i;
+  for(i = 0; i != numpixels; ++i, out += 3, in += 4)
+  {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+  }
+}
+
+static void greyToRgbaScalar(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i;
+  for(i = 0; i != numpixels; ++i, out += 4)
+  {
+    out[0] = out[1] = out[2] = in[i];
+    out[3] = 255;
+  }
+}
+
+static void extractScalar(unsigned char* out, const unsigned char* in, size_t count, size_t stride, size_t offset)
+{
+  size_t i;
+  in += offset;
+  for(i = 0; i != count; ++i, in += stride) out[i] = *in;
+}
+
+/*the LFS_MINSUM cost of a filtered byte: the byte itself for None, else the size of the difference as a signed
+byte, where 255 - d stands in for 256 - d, so -1 costs as little as 0*/
+#define FILTER_COST(d) ((d) < 128 ? (d) : 255u - (d))
+
+/*adds the costs of the bytes [start, length) of each filter type to sums. The pixel left of the first one and
+the row above the first row are 0, as in filterScanline.*/
+static void filterSumsRange(size_t* sums, const unsigned char* scanline, const unsigned char* prevline,
+                            size_t bytewidth, size_t start, size_t length)
+{
+  size_t i;
+  for(i = start; i < length; ++i)
+  {
+    unsigned char x = scanline[i];
+    unsigned char a = i >= bytewidth ? scanline[i - bytewidth] : 0;
+    unsigned char b = prevline ? prevline[i] : 0;
+    unsigned char c = prevline && i >= bytewidth ? prevline[i - bytewidth] : 0;
+    unsigned char d;
+    sums[0] += x;
+    d = (unsigned char)(x - a);
+    sums[1] += FILTER_COST(d);
+    d = (unsigned char)(x - b);
+    sums[2] += FILTER_COST(d);
+    d = (unsigned char)(x - (a + b) / 2);
+    sums[3] += FILTER_COST(d);
+    d = (unsigned char)(x - paethPredictor(a, b, c));
+    sums[4] += FILTER_COST(d);
+  }
+}
+
+static void filterSumsScalar(size_t* sums, const unsigned char* scanline, const unsigned char* prevline,
+                             size_t bytewidth, size_t length)
+{
+  unsigned type;
+  for(type = 0; type != 5; ++type) sums[type] = 0;
+  filterSumsRange(sums, scanline, prevline, bytewidth, 0, length);
+}
+
+static const PixelKernels scalarPixelKernels = { 0, 0, 0, 0, rgbToRgbaScalar, rgbaToRgbScalar, greyToRgbaScalar,
+                                                 extractScalar, filterSumsScalar };
+
+#if defined(LODEPNG_SIMD_X86) || defined(LODEPNG_SIMD_NEON)
+
+/*the 3 or 4 bytes of one pixel, first byte in the lowest bits*/
+static unsigned loadPixel(const unsigned char* p, size_t bytewidth)
+{
+  unsigned v = (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16);
+  if(bytewidth == 4) v |= (unsigned)p[3] << 24;
+  return v;
+}
+
+static void storePixel(unsigned char* p, unsigned v, size_t bytewidth)
+{
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  if(bytewidth == 4) p[3] = (unsigned char)(v >> 24);
+}
+
+/*Sub for the bytes from i on, after the vector loop*/
+static void unfilterSubTail(unsigned char* recon, const unsigned char* scanline, size_t bytewidth,
+                            size_t i, size_t length)
+{
+  for(; i < bytewidth && i < length; ++i) recon[i] = scanline[i];
+  for(; i < length; ++i) recon[i] = scanline[i] + recon[i - bytewidth];
+}
+
+#endif /*LODEPNG_SIMD_X86 || LODEPNG_SIMD_NEON*/
+
+#ifdef LODEPNG_SIMD_X86
+
+static __m128i loadPixelSSE2(const unsigned char* p, size_t bytewidth)
+{
+  return _mm_cvtsi32_si128((int)loadPixel(p, bytewidth));
+}
+
+static void storePixelSSE2(unsigned char* p, __m128i v, size_t bytewidth)
+{
+  storePixel(p, (unsigned)_mm_cvtsi128_si32(v), bytewidth);
+}
+
+/*stores bytes 0-11 of v*/
+static void store12SSE2(unsigned char* p, __m128i v)
+{
+  _mm_storel_epi64((__m128i*)p, v);
+  storePixel(p + 8, (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(v, 8)), 4);
+}
+
+static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  size_t i = 0;
+  __m128i last = _mm_setzero_si128(); /*the previous pixel in every pixel lane*/
+  if(bytewidth == 4)
+  {
+    for(; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, last);
+      _mm_storeu_si128((__m128i*)(recon + i), x);
+      last = _mm_shuffle_epi32(x, 0xFF);
+    }
+  }
+  else
+  {
+    /*4 pixels in bytes 0-11, the 16 byte load reads past them so stop 4 bytes early*/
+    const __m128i pixelmask = _mm_cvtsi32_si128(0xFFFFFF);
+    for(; i + 16 <= length; i += 12)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+      x = _mm_add_epi8(x, last);
+      store12SSE2(recon + i, x);
+      last = _mm_and_si128(_mm_srli_si128(x, 9), pixelmask);
+      last = _mm_or_si128(last, _mm_slli_si128(last, 3));
+      last = _mm_or_si128(last, _mm_slli_si128(last, 6));
+    }
+  }
+  unfilterSubTail(recon, scanline, bytewidth, i, length);
+}
+
+static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+    _mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bytemask = _mm_set1_epi16(0xFF);
+  __m128i a = zero; /*left pixel, 0 for the first one*/
+  for(i = 0; i + bytewidth <= length; i += bytewidth)
+  {
+    __m128i x = _mm_unpacklo_epi8(loadPixelSSE2(scanline + i, bytewidth), zero);
+    __m128i b = _mm_unpacklo_epi8(loadPixelSSE2(precon + i, bytewidth), zero);
+    a = _mm_and_si128(_mm_add_epi16(x, _mm_srli_epi16(_mm_add_epi16(a, b), 1)), bytemask);
+    storePixelSSE2(recon + i, _mm_packus_epi16(a, a), bytewidth);
+  }
+}
+
+/*Paeth predictor of 16-bit lanes, chooses as paethPredictor does: c if pc is the smallest, else b if pb < pa,
+else a. abs16 is |v| of the 16-bit lanes.*/
+#define PAETH_SSE2(result, a, b, c, abs16)\
+{\
+  __m128i pa_ = abs16(_mm_sub_epi16(b, c));\
+  __m128i pb_ = abs16(_mm_sub_epi16(a, c));\
+  __m128i pc_ = abs16(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a, c)));\
+  __m128i useb_ = _mm_cmplt_epi16(pb_, pa_);\
+  __m128i usec_ = _mm_and_si128(_mm_cmplt_epi16(pc_, pa_), _mm_cmplt_epi16(pc_, pb_));\
+  result = _mm_or_si128(_mm_and_si128(useb_, b), _mm_andnot_si128(useb_, a));\
+  result = _mm_or_si128(_mm_and_si128(usec_, c), _mm_andnot_si128(usec_, result));\
+}
+
+static __m128i abs16SSE2(__m128i v)
+{
+  return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+/*the first pixel starts from a = c = 0, for which the predictor gives b as the PNG specification says*/
+#define UNFILTER_PAETH_SSE2(abs16)\
+{\
+  size_t i;\
+  const __m128i zero = _mm_setzero_si128();\
+  const __m128i bytemask = _mm_set1_epi16(0xFF);\
+  __m128i a = zero, c = zero;\
+  for(i = 0; i + bytewidth <= length; i += bytewidth)\
+  {\
+    __m128i pred;\
+    __m128i x = _mm_unpacklo_epi8(loadPixelSSE2(scanline + i, bytewidth), zero);\
+    __m128i b = _mm_unpacklo_epi8(loadPixelSSE2(precon + i, bytewidth), zero);\
+    PAETH_SSE2(pred, a, b, c, abs16);\
+    a = _mm_and_si128(_mm_add_epi16(x, pred), bytemask);\
+    storePixelSSE2(recon + i, _mm_packus_epi16(a, a), bytewidth);\
+    c = b;\
+  }\
+}
+
+static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length)
+UNFILTER_PAETH_SSE2(abs16SSE2)
+
+/*SSSE3 adds a 16-bit abs for Paeth and a byte shuffle to spread the last RGB pixel for Sub*/
+
+LODEPNG_TARGET_SSSE3 static __m128i abs16SSSE3(__m128i v)
+{
+  return _mm_abs_epi16(v);
+}
+
+LODEPNG_TARGET_SSSE3
+static void unfilterPaethSSSE3(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                               size_t bytewidth, size_t length)
+UNFILTER_PAETH_SSE2(abs16SSSE3)
+
+LODEPNG_TARGET_SSSE3
+static void unfilterSubSSSE3(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  size_t i = 0;
+  __m128i last = _mm_setzero_si128();
+  const __m128i spread = _mm_setr_epi8(9, 10, 11, 9, 10, 11, 9, 10, 11, 9, 10, 11, 9, 10, 11, 9);
+  if(bytewidth == 4)
+  {
+    unfilterSubSSE2(recon, scanline, bytewidth, length);
+    return;
+  }
+  for(; i + 16 <= length; i += 12)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+    x = _mm_add_epi8(x, last);
+    store12SSE2(recon + i, x);
+    last = _mm_shuffle_epi8(x, spread);
+  }
+  unfilterSubTail(recon, scanline, bytewidth, i, length);
+}
+
+/*
+LFS_MINSUM costs 16 bytes at a time from the second pixel of a row with a row above on, the first pixel, the
+first row and the tail with the portable loop. Average is the rounded up average less the bit rounding added,
+Paeth is predicted in 16-bit lanes as for unfiltering, and a difference costs its bytes flipped when negative.
+*/
+#define FILTER_SUMS_SSE2(abs16)\
+{\
+  size_t i = bytewidth < length ? bytewidth : length;\
+  unsigned type;\
+  const __m128i zero = _mm_setzero_si128();\
+  const __m128i one = _mm_set1_epi8(1);\
+  __m128i acc[5];\
+  for(type = 0; type != 5; ++type)\
+  {\
+    sums[type] = 0;\
+    acc[type] = zero;\
+  }\
+  filterSumsRange(sums, scanline, prevline, bytewidth, 0, i);\
+  if(prevline)\
+  {\
+    for(; i + 16 <= length; i += 16)\
+    {\
+      __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));\
+      __m128i a = _mm_loadu_si128((const __m128i*)(scanline + i - bytewidth));\
+      __m128i b = _mm_loadu_si128((const __m128i*)(prevline + i));\
+      __m128i c = _mm_loadu_si128((const __m128i*)(prevline + i - bytewidth));\
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));\
+      __m128i alo = _mm_unpacklo_epi8(a, zero), blo = _mm_unpacklo_epi8(b, zero), clo = _mm_unpacklo_epi8(c, zero);\
+      __m128i ahi = _mm_unpackhi_epi8(a, zero), bhi = _mm_unpackhi_epi8(b, zero), chi = _mm_unpackhi_epi8(c, zero);\
+      __m128i plo, phi, d[4];\
+      PAETH_SSE2(plo, alo, blo, clo, abs16);\
+      PAETH_SSE2(phi, ahi, bhi, chi, abs16);\
+      d[0] = _mm_sub_epi8(x, a);\
+      d[1] = _mm_sub_epi8(x, b);\
+      d[2] = _mm_sub_epi8(x, avg);\
+      d[3] = _mm_sub_epi8(x, _mm_packus_epi16(plo, phi));\
+      acc[0] = _mm_add_epi64(acc[0], _mm_sad_epu8(x, zero));\
+      for(type = 0; type != 4; ++type)\
+      {\
+        __m128i cost = _mm_xor_si128(d[type], _mm_cmpgt_epi8(zero, d[type]));\
+        acc[type + 1] = _mm_add_epi64(acc[type + 1], _mm_sad_epu8(cost, zero));\
+      }\
+    }\
+    for(type = 0; type != 5; ++type)\
+    {\
+      uint64_t lanes[2];\
+      _mm_storeu_si128((__m128i*)lanes, acc[type]);\
+      sums[type] += (size_t)(lanes[0] + lanes[1]);\
+    }\
+  }\
+  filterSumsRange(sums, scanline, prevline, bytewidth, i, length);\
+}
+
+static void filterSumsSSE2(size_t* sums, const unsigned char* scanline, const unsigned char* prevline,
+                           size_t bytewidth, size_t length)
+FILTER_SUMS_SSE2(abs16SSE2)
+
+LODEPNG_TARGET_SSSE3
+static void filterSumsSSSE3(size_t* sums, const unsigned char* scanline, const unsigned char* prevline,
+                            size_t bytewidth, size_t length)
+FILTER_SUMS_SSE2(abs16SSSE3)
+
+/*color conversion, 16 output pixels or bytes per step and the rest with the portable kernels*/
+
+static void greyToRgbaSSE2(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  const __m128i opaque = _mm_set1_epi8((char)255);
+  for(; i + 16 <= numpixels; i += 16)
+  {
+    __m128i grey = _mm_loadu_si128((const __m128i*)(in + i));
+    __m128i gg = _mm_unpacklo_epi8(grey, grey), ga = _mm_unpacklo_epi8(grey, opaque);
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_unpacklo_epi16(gg, ga));
+    _mm_storeu_si128((__m128i*)(out + 4 * i + 16), _mm_unpackhi_epi16(gg, ga));
+    gg = _mm_unpackhi_epi8(grey, grey);
+    ga = _mm_unpackhi_epi8(grey, opaque);
+    _mm_storeu_si128((__m128i*)(out + 4 * i + 32), _mm_unpacklo_epi16(gg, ga));
+    _mm_storeu_si128((__m128i*)(out + 4 * i + 48), _mm_unpackhi_epi16(gg, ga));
+  }
+  greyToRgbaScalar(out + 4 * i, in + i, numpixels - i);
+}
+
+/*strides 2 and 4 by masking and packing 16-bit or 32-bit lanes, other strides with the portable kernel*/
+static void extractSSE2(unsigned char* out, const unsigned char* in, size_t count, size_t stride, size_t offset)
+{
+  size_t i = 0;
+  if(stride == 2)
+  {
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    for(; i + 16 <= count; i += 16)
+    {
+      __m128i x0 = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+      __m128i x1 = _mm_loadu_si128((const __m128i*)(in + 2 * i + 16));
+      if(offset)
+      {
+        x0 = _mm_srli_epi16(x0, 8);
+        x1 = _mm_srli_epi16(x1, 8);
+      }
+      _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_and_si128(x0, mask), _mm_and_si128(x1, mask)));
+    }
+  }
+  else if(stride == 4)
+  {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128i shift = _mm_cvtsi32_si128((int)(8 * offset));
+    for(; i + 16 <= count; i += 16)
+    {
+      __m128i x0 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i*)(in + 4 * i)), shift), mask);
+      __m128i x1 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i*)(in + 4 * i + 16)), shift), mask);
+      __m128i x2 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i*)(in + 4 * i + 32)), shift), mask);
+      __m128i x3 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i*)(in + 4 * i + 48)), shift), mask);
+      _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(x0, x1), _mm_packs_epi32(x2, x3)));
+    }
+  }
+  extractScalar(out + i, in + stride * i, count - i, stride, offset);
+}
+
+/*SSSE3: the 3 byte RGB pixels are moved with byte shuffles*/
+
+LODEPNG_TARGET_SSSE3
+static void rgbToRgbaSSSE3(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i opaque = _mm_set1_epi32((int)0xFF000000u);
+  /*4 pixels per 16 byte load of 12 bytes, the last load must stay within the input*/
+  for(; 3 * i + 16 <= 3 * numpixels; i += 4)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)(in + 3 * i));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_or_si128(_mm_shuffle_epi8(x, spread), opaque));
+  }
+  rgbToRgbaScalar(out + 4 * i, in + 3 * i, numpixels - i);
+}
+
+LODEPNG_TARGET_SSSE3
+static void rgbaToRgbSSSE3(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  for(; i + 4 <= numpixels; i += 4)
+  {
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 4 * i)), pack);
+    store12SSE2(out + 3 * i, x);
+  }
+  rgbaToRgbScalar(out + 3 * i, in + 4 * i, numpixels - i);
+}
+
+/*stride 3 takes 16 bytes out of 48 with three shuffles, the others go to the SSE2 kernel*/
+LODEPNG_TARGET_SSSE3
+static void extractSSSE3(unsigned char* out, const unsigned char* in, size_t count, size_t stride, size_t offset)
+{
+  size_t i = 0, j;
+  char select[3][16];
+  __m128i select0, select1, select2;
+  if(stride != 3)
+  {
+    extractSSE2(out, in, count, stride, offset);
+    return;
+  }
+  /*byte j of the result is byte 3 * j + offset of the 48, so in vector (3 * j + offset) / 16*/
+  for(j = 0; j != 16; ++j)
+  {
+    size_t source = 3 * j + offset;
+    select[0][j] = select[1][j] = select[2][j] = -1;
+    select[source / 16][j] = (char)(source % 16);
+  }
+  select0 = _mm_loadu_si128((const __m128i*)select[0]);
+  select1 = _mm_loadu_si128((const __m128i*)select[1]);
+  select2 = _mm_loadu_si128((const __m128i*)select[2]);
+  for(; i + 16 <= count; i += 16)
+  {
+    __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 3 * i)), select0);
+    __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 3 * i + 16)), select1);
+    __m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 3 * i + 32)), select2);
+    _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(_mm_or_si128(x0, x1), x2));
+  }
+  extractScalar(out + i, in + 3 * i, count - i, 3, offset);
+}
+
+static const PixelKernels sse2PixelKernels = { unfilterSubSSE2, unfilterUpSSE2, unfilterAverageSSE2,
+                                               unfilterPaethSSE2, rgbToRgbaScalar, rgbaToRgbScalar,
+                                               greyToRgbaSSE2, extractSSE2, filterSumsSSE2 };
+static const PixelKernels ssse3PixelKernels = { unfilterSubSSSE3, unfilterUpSSE2, unfilterAverageSSE2,
+                                                unfilterPaethSSSE3, rgbToRgbaSSSE3, rgbaToRgbSSSE3,
+                                                greyToRgbaSSE2, extractSSSE3, filterSumsSSSE3 };
+
+#endif /*LODEPNG_SIMD_X86*/
+
+#ifdef LODEPNG_SIMD_NEON
+
+/*one pixel in the low lanes of a 16-bit vector*/
+static int16x4_t loadPixelNEON(const unsigned char* p, size_t bytewidth)
+{
+  return vreinterpret_s16_u16(vget_low_u16(vmovl_u8(vcreate_u8(loadPixel(p, bytewidth)))));
+}
+
+static void storePixelNEON(unsigned char* p, int16x4_t v, size_t bytewidth)
+{
+  uint8x8_t bytes = vmovn_u16(vcombine_u16(vreinterpret_u16_s16(v), vreinterpret_u16_s16(v)));
+  storePixel(p, vget_lane_u32(vreinterpret_u32_u8(bytes), 0), bytewidth);
+}
+
+static void unfilterSubNEON(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  size_t i = 0;
+  const uint8x16_t zero = vdupq_n_u8(0);
+  uint8x16_t last = zero;
+  if(bytewidth == 4)
+  {
+    for(; i + 16 <= length; i += 16)
+    {
+      uint8x16_t x = vld1q_u8(scanline + i);
+      x = vaddq_u8(x, vextq_u8(zero, x, 12)); /*x shifted up by one pixel*/
+      x = vaddq_u8(x, vextq_u8(zero, x, 8));
+      x = vaddq_u8(x, last);
+      vst1q_u8(recon + i, x);
+      last = vreinterpretq_u8_u32(vdupq_laneq_u32(vreinterpretq_u32_u8(x), 3));
+    }
+  }
+  else
+  {
+    static const unsigned char spreadbytes[16] = { 9, 10, 11, 9, 10, 11, 9, 10, 11, 9, 10, 11, 9, 10, 11, 9 };
+    const uint8x16_t spread = vld1q_u8(spreadbytes);
+    for(; i + 16 <= length; i += 12)
+    {
+      uint8x16_t x = vld1q_u8(scanline + i);
+      x = vaddq_u8(x, vextq_u8(zero, x, 13));
+      x = vaddq_u8(x, vextq_u8(zero, x, 10));
+      x = vaddq_u8(x, last);
+      vst1_u8(recon + i, vget_low_u8(x));
+      storePixel(recon + i + 8, vgetq_lane_u32(vreinterpretq_u32_u8(x), 2), 4);
+      last = vqtbl1q_u8(x, spread);
+    }
+  }
+  unfilterSubTail(recon, scanline, bytewidth, i, length);
+}
+
+static void unfilterUpNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16) vst1q_u8(recon + i, vaddq_u8(vld1q_u8(scanline + i), vld1q_u8(precon + i)));
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterAverageNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length)
+{
+  size_t i;
+  const int16x4_t bytemask = vdup_n_s16(0xFF);
+  int16x4_t a = vdup_n_s16(0);
+  for(i = 0; i + bytewidth <= length; i += bytewidth)
+  {
+    int16x4_t x = loadPixelNEON(scanline + i, bytewidth);
+    int16x4_t b = loadPixelNEON(precon + i, bytewidth);
+    a = vand_s16(vadd_s16(x, vshr_n_s16(vadd_s16(a, b), 1)), bytemask);
+    storePixelNEON(recon + i, a, bytewidth);
+  }
+}
+
+static void unfilterPaethNEON(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length)
+{
+  size_t i;
+  const int16x4_t bytemask = vdup_n_s16(0xFF);
+  int16x4_t a = vdup_n_s16(0), c = vdup_n_s16(0);
+  for(i = 0; i + bytewidth <= length; i += bytewidth)
+  {
+    int16x4_t x = loadPixelNEON(scanline + i, bytewidth);
+    int16x4_t b = loadPixelNEON(precon + i, bytewidth);
+    int16x4_t pa = vabd_s16(b, c);
+    int16x4_t pb = vabd_s16(a, c);
+    int16x4_t pc = vabs_s16(vadd_s16(vsub_s16(b, c), vsub_s16(a, c)));
+    int16x4_t pred = vbsl_s16(vclt_s16(pb, pa), b, a);
+    pred = vbsl_s16(vand_u16(vclt_s16(pc, pa), vclt_s16(pc, pb)), c, pred);
+    a = vand_s16(vadd_s16(x, pred), bytemask);
+    storePixelNEON(recon + i, a, bytewidth);
+    c = b;
+  }
+}
+
+/*LFS_MINSUM costs as filterSumsSSE2: Average is a halving add, and the costs are added pairwise into 32-bit
+lanes, which hold the sums of rows up to 64MB*/
+static void filterSumsNEON(size_t* sums, const unsigned char* scanline, const unsigned char* prevline,
+                           size_t bytewidth, size_t length)
+{
+  size_t i = bytewidth < length ? bytewidth : length;
+  unsigned type;
+  uint32x4_t acc[5];
+  for(type = 0; type != 5; ++type)
+  {
+    sums[type] = 0;
+    acc[type] = vdupq_n_u32(0);
+  }
+  filterSumsRange(sums, scanline, prevline, bytewidth, 0, i);
+  if(prevline)
+  {
+    for(; i + 16 <= length; i += 16)
+    {
+      uint8x16_t x = vld1q_u8(scanline + i);
+      uint8x16_t a = vld1q_u8(scanline + i - bytewidth);
+      uint8x16_t b = vld1q_u8(prevline + i);
+      uint8x16_t c = vld1q_u8(prevline + i - bytewidth);
+      uint8x16_t d[4];
+      int16x8_t pred[2];
+      unsigned half;
+      for(half = 0; half != 2; ++half)
+      {
+        int16x8_t a16 = vreinterpretq_s16_u16(vmovl_u8(half ? vget_high_u8(a) : vget_low_u8(a)));
+        int16x8_t b16 = vreinterpretq_s16_u16(vmovl_u8(half ? vget_high_u8(b) : vget_low_u8(b)));
+        int16x8_t c16 = vreinterpretq_s16_u16(vmovl_u8(half ? vget_high_u8(c) : vget_low_u8(c)));
+        int16x8_t pa = vabdq_s16(b16, c16);
+        int16x8_t pb = vabdq_s16(a16, c16);
+        int16x8_t pc = vabsq_s16(vaddq_s16(vsubq_s16(b16, c16), vsubq_s16(a16, c16)));
+        pred[half] = vbslq_s16(vcltq_s16(pb, pa), b16, a16);
+        pred[half] = vbslq_s16(vandq_u16(vcltq_s16(pc, pa), vcltq_s16(pc, pb)), c16, pred[half]);
+      }
+      d[0] = vsubq_u8(x, a);
+      d[1] = vsubq_u8(x, b);
+      d[2] = vsubq_u8(x, vhaddq_u8(a, b));
+      d[3] = vsubq_u8(x, vcombine_u8(vmovn_u16(vreinterpretq_u16_s16(pred[0])),
+                                     vmovn_u16(vreinterpretq_u16_s16(pred[1]))));
+      acc[0] = vpadalq_u16(acc[0], vpaddlq_u8(x));
+      for(type = 0; type != 4; ++type)
+      {
+        uint8x16_t sign = vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(d[type]), 7));
+        acc[type + 1] = vpadalq_u16(acc[type + 1], vpaddlq_u8(veorq_u8(d[type], sign)));
+      }
+    }
+    for(type = 0; type != 5; ++type) sums[type] += (size_t)vaddlvq_u32(acc[type]);
+  }
+  filterSumsRange(sums, scanline, prevline, bytewidth, i, length);
+}
+
+/*color conversion with the NEON interleaving loads and stores, 16 pixels per step*/
+
+static void rgbToRgbaNEON(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  for(; i + 16 <= numpixels; i += 16)
+  {
+    uint8x16x3_t rgb = vld3q_u8(in + 3 * i);
+    uint8x16x4_t rgba;
+    rgba.val[0] = rgb.val[0];
+    rgba.val[1] = rgb.val[1];
+    rgba.val[2] = rgb.val[2];
+    rgba.val[3] = vdupq_n_u8(255);
+    vst4q_u8(out + 4 * i, rgba);
+  }
+  rgbToRgbaScalar(out + 4 * i, in + 3 * i, numpixels - i);
+}
+
+static void rgbaToRgbNEON(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  for(; i + 16 <= numpixels; i += 16)
+  {
+    uint8x16x4_t rgba = vld4q_u8(in + 4 * i);
+    uint8x16x3_t rgb;
+    rgb.val[0] = rgba.val[0];
+    rgb.val[1] = rgba.val[1];
+    rgb.val[2] = rgba.val[2];
+    vst3q_u8(out + 3 * i, rgb);
+  }
+  rgbaToRgbScalar(out + 3 * i, in + 4 * i, numpixels - i);
+}
+
+static void greyToRgbaNEON(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  for(; i + 16 <= numpixels; i += 16)
+  {
+    uint8x16x4_t rgba;
+    rgba.val[0] = rgba.val[1] = rgba.val[2] = vld1q_u8(in + i);
+    rgba.val[3] = vdupq_n_u8(255);
+    vst4q_u8(out + 4 * i, rgba);
+  }
+  greyToRgbaScalar(out + 4 * i, in + i, numpixels - i);
+}
+
+static void extractNEON(unsigned char* out, const unsigned char* in, size_t count, size_t stride, size_t offset)
+{
+  size_t i = 0;
+  if(stride == 2)
+  {
+    for(; i + 16 <= count; i += 16) vst1q_u8(out + i, vld2q_u8(in + 2 * i).val[offset]);
+  }
+  else if(stride == 3)
+  {
+    for(; i + 16 <= count; i += 16) vst1q_u8(out + i, vld3q_u8(in + 3 * i).val[offset]);
+  }
+  else if(stride == 4)
+  {
+    for(; i + 16 <= count; i += 16) vst1q_u8(out + i, vld4q_u8(in + 4 * i).val[offset]);
+  }
+  extractScalar(out + i, in + stride * i, count - i, stride, offset);
+}
+
+static const PixelKernels neonPixelKernels = { unfilterSubNEON, unfilterUpNEON, unfilterAverageNEON,
+                                               unfilterPaethNEON, rgbToRgbaNEON, rgbaToRgbNEON,
+                                               greyToRgbaNEON, extractNEON, filterSumsNEON };
+
+#endif /*LODEPNG_SIMD_NEON*/
+
+/*the widest kernels this CPU supports, chosen on first use*/
+static const PixelKernels* pixelKernels(void)
+{
+  static const PixelKernels* selected = 0;
+  if(selected) return selected;
+#if defined(LODEPNG_SIMD_X86)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("ssse3")) selected = &ssse3PixelKernels;
+  else if(__builtin_cpu_supports("sse2")) selected = &sse2PixelKernels;
+  else selected = &scalarPixelKernels;
+#elif defined(LODEPNG_SIMD_NEON)
+  selected = &neonPixelKernels;
+#else
+  selected = &scalarPixelKernels;
+#endif
+  return selected;
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Color types and such                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -3412,6 +4772,34 @@ static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned s
   }
 }
 
+/*The common conversions that have a kernel of their own, chosen once for the whole image instead of per pixel:
+RGB8 <-> RGBA8, RGB8/RGBA8 -> GREY8, GREY8 -> RGBA8 and 16-bit to 8-bit of the same color type (keeping the
+high bytes as getPixelColorRGBA8 does). Returns 0 if the pair of color modes has none.*/
+static unsigned convertWithKernels(unsigned char* out, const unsigned char* in,
+                                   const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                   size_t numpixels)
+{
+  const PixelKernels* kernels = pixelKernels();
+  LodePNGColorType type_in = mode_in->colortype, type_out = mode_out->colortype;
+  if(mode_out->bitdepth != 8) return 0;
+
+  if(mode_in->bitdepth == 16 && type_in == type_out)
+  {
+    /*a key needs no handling: only GREY and RGB have one, and their output has no alpha channel*/
+    kernels->extract(out, in, numpixels * getNumColorChannels(type_in), 2, 0);
+    return 1;
+  }
+  if(mode_in->bitdepth != 8) return 0;
+
+  if(type_in == LCT_RGB && type_out == LCT_RGBA && !mode_in->key_defined) kernels->rgbToRgba(out, in, numpixels);
+  else if(type_in == LCT_RGBA && type_out == LCT_RGB) kernels->rgbaToRgb(out, in, numpixels);
+  else if(type_in == LCT_RGBA && type_out == LCT_GREY) kernels->extract(out, in, numpixels, 4, 0);
+  else if(type_in == LCT_RGB && type_out == LCT_GREY) kernels->extract(out, in, numpixels, 3, 0);
+  else if(type_in == LCT_GREY && type_out == LCT_RGBA && !mode_in->key_defined) kernels->greyToRgba(out, in, numpixels);
+  else return 0;
+  return 1;
+}
+
 unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
                          unsigned w, unsigned h)
@@ -3427,6 +4815,8 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     return 0;
   }
 
+  if(convertWithKernels(out, in, mode_out, mode_in, numpixels)) return 0;
+
   if(mode_out->colortype == LCT_PALETTE)
   {
     size_t palsize = 1u << mode_out->bitdepth;
@@ -3474,6 +4864,73 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
   return 0; /*no error (this function currently never has one, but maybe OOM detection added later.)*/
 }
 
+/*Writes channel channels[k] of the RGBA8 color of numpixels pixels to planes[k], for each of the numplanes
+planes. in has the color mode mode and starts at a byte. The 8 and 16-bit color types are read with a fixed
+stride and 8-bit palettes through a table of the channel, the rest go through getPixelColorRGBA8.*/
+static void getPixelColorsPlanes(unsigned char** planes, const unsigned* channels, unsigned numplanes,
+                                 size_t numpixels, const unsigned char* in, const LodePNGColorMode* mode)
+{
+  const PixelKernels* kernels = pixelKernels();
+  size_t i;
+  unsigned k;
+  unsigned bytes = mode->bitdepth / 8; /*per channel, 0 for bit depths below 8*/
+  unsigned numchannels = getNumColorChannels(mode->colortype);
+
+  for(k = 0; k != numplanes; ++k)
+  {
+    unsigned char* plane = planes[k];
+    unsigned channel = channels[k];
+    /*which of the channels of the pixel holds the wanted one, or numchannels if it is not stored*/
+    unsigned source = numchannels;
+    if(mode->colortype == LCT_RGB || mode->colortype == LCT_RGBA) source = channel < numchannels ? channel : numchannels;
+    else if(mode->colortype == LCT_GREY || mode->colortype == LCT_GREY_ALPHA) source = channel < 3 ? 0 : numchannels - 1;
+    if(channel == 3 && (mode->colortype == LCT_GREY || mode->colortype == LCT_RGB)) source = numchannels;
+
+    if(bytes != 0 && mode->colortype != LCT_PALETTE && source < numchannels)
+    {
+      /*the high byte of 16-bit channels*/
+      kernels->extract(plane, in, numpixels, numchannels * bytes, source * bytes);
+    }
+    else if(bytes != 0 && channel == 3 && !mode->key_defined
+            && (mode->colortype == LCT_GREY || mode->colortype == LCT_RGB))
+    {
+      for(i = 0; i != numpixels; ++i) plane[i] = 255;
+    }
+    else if(mode->colortype == LCT_PALETTE && mode->bitdepth == 8)
+    {
+      unsigned char table[256];
+      for(i = 0; i != 256; ++i)
+      {
+        /*out of range indices are black, see getPixelColorRGBA8*/
+        table[i] = i < mode->palettesize ? mode->palette[i * 4 + channel] : (channel == 3 ? 255 : 0);
+      }
+      for(i = 0; i != numpixels; ++i) plane[i] = table[in[i]];
+    }
+    else
+    {
+      for(i = 0; i != numpixels; ++i)
+      {
+        unsigned char rgba[4];
+        getPixelColorRGBA8(&rgba[0], &rgba[1], &rgba[2], &rgba[3], in, i, mode);
+        plane[i] = rgba[channel & 3];
+      }
+    }
+  }
+}
+
+unsigned lodepng_convert_planes(unsigned char** planes, const unsigned* channels, unsigned numplanes,
+                                const unsigned char* in, const LodePNGColorMode* mode_in,
+                                unsigned w, unsigned h)
+{
+  unsigned k;
+  for(k = 0; k != numplanes; ++k)
+  {
+    if(channels[k] > 3) return 56; /*unsupported color mode conversion*/
+  }
+  getPixelColorsPlanes(planes, channels, numplanes, (size_t)w * h, in, mode_in);
+  return 0;
+}
+
 #ifdef LODEPNG_COMPILE_ENCODER
 
 void lodepng_color_profile_init(LodePNGColorProfile* profile)
@@ -3739,22 +5196,6 @@ unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out,
 
 #endif /* #ifdef LODEPNG_COMPILE_ENCODER */
 
-/*
-Paeth predicter, used by PNG filter type 4
-The parameters are of type short, but should come from unsigned chars, the shorts
-are only needed to make the paeth calculation correct.
-*/
-static unsigned char paethPredictor(short a, short b, short c)
-{
-  short pa = abs(b - c);
-  short pb = abs(a - c);
-  short pc = abs(a + b - c - c);
-
-  if(pc < pa && pc < pb) return (unsigned char)c;
-  else if(pb < pa) return (unsigned char)b;
-  else return (unsigned char)a;
-}
-
 /*shared values used by multiple Adam7 related functions*/
 
 static const unsigned ADAM7_IX[7] = { 0, 4, 0, 2, 0, 1, 0 }; /*x start values*/
@@ -3887,6 +5328,25 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+  /*Up works on any pixel size, the others only on whole RGB8/RGBA8 sized pixels*/
+  const PixelKernels* kernels = pixelKernels();
+  int pixelwise = kernels->sub && (bytewidth == 3 || bytewidth == 4);
+  if(kernels->up && precon && filterType == 2)
+  {
+    kernels->up(recon, scanline, precon, length);
+    return 0;
+  }
+  if(pixelwise && filterType == 1)
+  {
+    kernels->sub(recon, scanline, bytewidth, length);
+    return 0;
+  }
+  if(pixelwise && precon && (filterType == 3 || filterType == 4))
+  {
+    if(filterType == 3) kernels->average(recon, scanline, precon, bytewidth, length);
+    else kernels->paeth(recon, scanline, precon, bytewidth, length);
+    return 0;
+  }
   switch(filterType)
   {
     case 0:
@@ -4426,17 +5886,31 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+/*read the header and chunks of a PNG into state and return the compressed data of its IDAT chunks in idatdata
+and idatsize. A single IDAT chunk is used where it is in the PNG; several are concatenated in idat.*/
+/*total length of the IDAT chunks from chunk up to IEND or the end of in, so a concatenation of them is
+allocated once. A chunk that doesn't fit in in ends the count, readChunks reports it when it gets there.*/
+static size_t idatLength(const unsigned char* chunk, const unsigned char* in, size_t insize)
+{
+  size_t total = 0;
+  while((size_t)(chunk - in) + 12 <= insize)
+  {
+    unsigned chunkLength = lodepng_chunk_length(chunk);
+    if(chunkLength > insize - (size_t)(chunk - in) - 12) break;
+    if(lodepng_chunk_type_equals(chunk, "IDAT")) total += chunkLength;
+    else if(lodepng_chunk_type_equals(chunk, "IEND")) break;
+    chunk += chunkLength + 12;
+  }
+  return total;
+}
+
+static void readChunks(ucvector* idat, const unsigned char** idatdata, size_t* idatsize, unsigned* w, unsigned* h,
+                       LodePNGState* state,
+                       const unsigned char* in, size_t insize)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
   size_t i;
-  ucvector idat; /*the data from idat chunks*/
-  ucvector scanlines;
-  size_t predict;
   size_t numpixels;
 
   /*for unknown chunk order*/
@@ -4445,9 +5919,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
 
@@ -4459,7 +5930,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   bytes with 16-bit RGBA, the rest is room for filter bytes.*/
   if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
 
-  ucvector_init(&idat);
+  *idatdata = 0;
+  *idatsize = 0;
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
@@ -4487,9 +5959,28 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      if(*idatsize == 0)
+      {
+        *idatdata = data;
+        *idatsize = chunkLength;
+      }
+      else
+      {
+        size_t oldsize = idat->size;
+        if(oldsize == 0)
+        {
+          /*second IDAT chunk: start concatenating with the first one, in a buffer that holds this and all the
+          IDAT chunks after it, so that it never has to grow*/
+          if(!ucvector_reserve(idat, *idatsize + idatLength(chunk, in, insize))) CERROR_BREAK(state->error, 83 /*alloc fail*/);
+          if(!ucvector_resize(idat, *idatsize)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
+          for(i = 0; i != *idatsize; ++i) idat->data[i] = (*idatdata)[i];
+          oldsize = idat->size;
+        }
+        if(!ucvector_resize(idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
+        for(i = 0; i != chunkLength; ++i) idat->data[oldsize + i] = data[i];
+        *idatdata = idat->data;
+        *idatsize = idat->size;
+      }
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4582,9 +6073,29 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 
     if(!IEND) chunk = lodepng_chunk_next_const(chunk);
   }
+}
 
-  ucvector_init(&scanlines);
-  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
+/*read the chunks of a PNG and inflate its IDAT data into scanlines: the filtered (and possibly
+interlaced) scanlines with their filter type bytes, as postProcessScanlines takes them*/
+static void decodeScanlines(ucvector* scanlines, unsigned* w, unsigned* h,
+                            LodePNGState* state,
+                            const unsigned char* in, size_t insize)
+{
+  ucvector idat; /*the data from idat chunks*/
+  const unsigned char* idatdata;
+  size_t idatsize;
+  size_t predict;
+  LodePNGDecompressSettings zlibsettings;
+
+  ucvector_init(&idat);
+  readChunks(&idat, &idatdata, &idatsize, w, h, state, in, insize);
+  if(state->error)
+  {
+    ucvector_cleanup(&idat);
+    return;
+  }
+
+  /*predict output size, so that the inflater allocates the exact size for the output buffer at once.
   If the decompressed size does not match the prediction, the image must be corrupt.*/
   if(state->info_png.interlace_method == 0)
   {
@@ -4604,24 +6115,141 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) / 2, (*h + 1) / 2, color) + (*h + 1) / 2;
     predict += lodepng_get_raw_size_idat((*w + 0) / 1, (*h + 0) / 2, color) + (*h + 0) / 2;
   }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
+  zlibsettings = state->decoder.zlibsettings;
+  zlibsettings.expected_size = predict;
   if(!state->error)
   {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
-    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+    state->error = zlib_decompress(&scanlines->data, &scanlines->size, idatdata, idatsize, &zlibsettings);
+    if(!state->error && scanlines->size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
   }
   ucvector_cleanup(&idat);
+}
+
+/*
+Where decodeImage and decodePlanes put their output. Called once the IDAT data has been inflated to the
+predicted size, so a corrupt header cannot make it allocate more than the PNG really holds, with the index of
+the output (0 for the image, k for plane k) and its size in bytes. Sets *buffer and returns 0, or returns an
+error code.
+*/
+typedef unsigned (*DecodeOutput)(void* user, unsigned index, unsigned char** buffer, size_t size);
+
+/*DecodeOutput allocating each buffer with lodepng_malloc, the caller frees them*/
+static unsigned mallocOutput(void* user, unsigned index, unsigned char** buffer, size_t size)
+{
+  (void)user;
+  (void)index;
+  *buffer = (unsigned char*)lodepng_malloc(size);
+  return *buffer ? 0 : 83; /*alloc fail*/
+}
+
+/*buffers of the caller for lodepng_decode_into and lodepng_decode_planes_into*/
+typedef struct GivenOutput
+{
+  unsigned char* const* buffers;
+  size_t size; /*of every buffer*/
+} GivenOutput;
+
+static unsigned givenOutput(void* user, unsigned index, unsigned char** buffer, size_t size)
+{
+  const GivenOutput* given = (const GivenOutput*)user;
+  if(size > given->size) return 94; /*output buffer too small*/
+  *buffer = given->buffers[index];
+  return 0;
+}
+
+/*the image in the color type of the PNG from the scanlines of decodeScanlines. Without interlacing and with
+whole bytes per pixel the scanlines are unfiltered in place and the result is scanlines->data, otherwise it is
+a new buffer, which the caller frees. Returns NULL on error, with state->error set.*/
+static unsigned char* reconstructImage(ucvector* scanlines, unsigned w, unsigned h, LodePNGState* state)
+{
+  unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+  unsigned char* image;
+  size_t outsize, i;
+
+  if(state->info_png.interlace_method == 0 && bpp >= 8)
+  {
+    state->error = unfilter(scanlines->data, scanlines->data, w, h, bpp);
+    return state->error ? 0 : scanlines->data;
+  }
+
+  outsize = lodepng_get_raw_size(w, h, &state->info_png.color);
+  image = (unsigned char*)lodepng_malloc(outsize);
+  if(!image)
+  {
+    state->error = 83; /*alloc fail*/
+    return 0;
+  }
+  for(i = 0; i != outsize; ++i) image[i] = 0; /*postProcessScanlines needs zeroes for bpp < 8*/
+  state->error = postProcessScanlines(image, scanlines->data, w, h, &state->info_png);
+  if(state->error)
+  {
+    lodepng_free(image);
+    return 0;
+  }
+  return image;
+}
+
+/*
+Decode to the color mode of state->info_raw, or of the PNG if color_convert is off, into the buffer that
+output gives, which is also stored in *out. The pixels are written into that buffer once: unfiltered straight into it when the color
+modes are the same, or otherwise converted from the scanlines unfiltered in place, so the image is not first
+built in the PNG's color mode in a buffer of its own.
+*/
+static void decodeImage(unsigned char** out, unsigned* w, unsigned* h, LodePNGState* state,
+                        const unsigned char* in, size_t insize,
+                        DecodeOutput output, void* user)
+{
+  ucvector scanlines;
+  unsigned convert = 0;
+  size_t outsize = 0;
+
+  ucvector_init(&scanlines);
+  decodeScanlines(&scanlines, w, h, state, in, insize);
+
+  if(!state->error)
+  {
+    if(!state->decoder.color_convert)
+    {
+      /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
+      the raw image has to the end user*/
+      state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+    }
+    else if(!lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+    {
+      /*TODO: check if this works according to the statement in the documentation: "The converter can convert
+      from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
+      if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+         && !(state->info_raw.bitdepth == 8))
+      {
+        state->error = 56; /*unsupported color mode conversion*/
+      }
+      convert = 1;
+    }
+  }
 
   if(!state->error)
   {
-    size_t outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
-    ucvector outv;
-    ucvector_init(&outv);
-    if(!ucvector_resizev(&outv, outsize, 0)) state->error = 83; /*alloc fail*/
-    if(!state->error) state->error = postProcessScanlines(outv.data, scanlines.data, *w, *h, &state->info_png);
-    *out = outv.data;
+    outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
+    state->error = output(user, 0, out, outsize);
+  }
+
+  if(!state->error && !convert)
+  {
+    /*same color type, unfilter straight into the output*/
+    if(lodepng_get_bpp(&state->info_png.color) < 8)
+    {
+      size_t i;
+      for(i = 0; i != outsize; ++i) (*out)[i] = 0; /*postProcessScanlines needs zeroes for bpp < 8*/
+    }
+    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+  }
+  else if(!state->error)
+  {
+    unsigned char* image = reconstructImage(&scanlines, *w, *h, state);
+    if(image) state->error = lodepng_convert(*out, image, &state->info_raw, &state->info_png.color, *w, *h);
+    if(image != scanlines.data) lodepng_free(image);
   }
+
   ucvector_cleanup(&scanlines);
 }
 
@@ -4630,43 +6258,274 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         const unsigned char* in, size_t insize)
 {
   *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
-  if(state->error) return state->error;
-  if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  decodeImage(out, w, h, state, in, insize, mallocOutput, 0);
+  if(state->error)
   {
-    /*same color type, no copying or converting of data needed*/
-    /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
-    the raw image has to the end user*/
-    if(!state->decoder.color_convert)
+    lodepng_free(*out);
+    *out = 0;
+  }
+  return state->error;
+}
+
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize)
+{
+  GivenOutput given;
+  unsigned char* written = 0;
+  given.buffers = &out;
+  given.size = outsize;
+  decodeImage(&written, w, h, state, in, insize, givenOutput, &given);
+  return state->error;
+}
+
+/*decode to numplanes planes as lodepng_convert_planes does, into the buffers that output gives*/
+static void decodePlanes(const unsigned* channels, unsigned numplanes,
+                         unsigned* w, unsigned* h, LodePNGState* state,
+                         const unsigned char* in, size_t insize,
+                         DecodeOutput output, void* user, unsigned char** planes)
+{
+  ucvector scanlines;
+  unsigned char* image = 0;
+  unsigned k;
+
+  ucvector_init(&scanlines);
+  decodeScanlines(&scanlines, w, h, state, in, insize);
+
+  /*the planes are read from the image in the PNG's own color type, which is the unfiltered scanlines
+  themselves for non-interlaced images with whole bytes per pixel, so no other full size buffer is made*/
+  if(!state->error) image = reconstructImage(&scanlines, *w, *h, state);
+
+  for(k = 0; k != numplanes && !state->error; ++k)
+  {
+    state->error = output(user, k, &planes[k], (size_t)(*w) * (*h));
+  }
+  if(!state->error)
+  {
+    state->error = lodepng_convert_planes(planes, channels, numplanes, image, &state->info_png.color, *w, *h);
+  }
+
+  if(image != scanlines.data) lodepng_free(image);
+  ucvector_cleanup(&scanlines);
+}
+
+unsigned lodepng_decode_planes(unsigned char** planes, const unsigned* channels, unsigned numplanes,
+                               unsigned* w, unsigned* h, LodePNGState* state,
+                               const unsigned char* in, size_t insize)
+{
+  unsigned k;
+  for(k = 0; k != numplanes; ++k) planes[k] = 0;
+  decodePlanes(channels, numplanes, w, h, state, in, insize, mallocOutput, 0, planes);
+  if(state->error)
+  {
+    for(k = 0; k != numplanes; ++k)
     {
-      state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
-      if(state->error) return state->error;
+      lodepng_free(planes[k]);
+      planes[k] = 0;
     }
   }
-  else
-  {
-    /*color conversion needed; sort of copy of the data*/
-    unsigned char* data = *out;
-    size_t outsize;
+  return state->error;
+}
 
-    /*TODO: check if this works according to the statement in the documentation: "The converter can convert
-    from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
-    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
-       && !(state->info_raw.bitdepth == 8))
+unsigned lodepng_decode_planes_into(unsigned char* const* planes, size_t planesize,
+                                    const unsigned* channels, unsigned numplanes,
+                                    unsigned* w, unsigned* h, LodePNGState* state,
+                                    const unsigned char* in, size_t insize)
+{
+  GivenOutput given;
+  unsigned char** written = (unsigned char**)lodepng_malloc((numplanes ? numplanes : 1) * sizeof(unsigned char*));
+  if(!written) CERROR_RETURN_ERROR(state->error, 83); /*alloc fail*/
+  given.buffers = planes;
+  given.size = planesize;
+  decodePlanes(channels, numplanes, w, h, state, in, insize, givenOutput, &given, written);
+  lodepng_free(written);
+  return state->error;
+}
+
+/*state of lodepng_decode_rows: the inflated bytes are gathered into one filtered scanline at a time, which is
+unfiltered against the previous one and converted into a row of each plane*/
+/*assembles the inflated IDAT data into whole scanlines for a LodePNGScanlineCallback*/
+typedef struct ScanlineSink
+{
+  size_t size; /*bytes per scanline with the filter type byte*/
+  unsigned h;
+  unsigned char* line; /*scanline being filled, filter type byte first*/
+  size_t fill; /*bytes of line filled so far*/
+  unsigned y; /*row of line*/
+  LodePNGScanlineCallback callback;
+  void* user;
+} ScanlineSink;
+
+static unsigned scanlineSinkWrite(void* user, const unsigned char* data, size_t size)
+{
+  ScanlineSink* s = (ScanlineSink*)user;
+  while(size > 0)
+  {
+    size_t amount = s->size - s->fill;
+    const unsigned char* scanline = data;
+    unsigned error;
+    if(s->y >= s->h) return 91; /*decompressed size doesn't match prediction*/
+    if(amount > size) amount = size;
+    /*whole scanlines in the window are passed on where they are, only the ones cut in two are copied*/
+    if(s->fill != 0 || amount != s->size)
     {
-      return 56; /*unsupported color mode conversion*/
+      size_t i;
+      for(i = 0; i != amount; ++i) s->line[s->fill + i] = data[i];
+      scanline = s->line;
     }
+    s->fill += amount;
+    data += amount;
+    size -= amount;
+    if(s->fill != s->size) break;
 
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
-    *out = (unsigned char*)lodepng_malloc(outsize);
-    if(!(*out))
+    error = s->callback(s->user, s->y, scanline, s->size);
+    if(error) return error;
+    s->fill = 0;
+    ++s->y;
+  }
+  return 0;
+}
+
+unsigned lodepng_inflate_scanlines(unsigned* w, unsigned* h, LodePNGState* state,
+                                   const unsigned char* in, size_t insize,
+                                   LodePNGScanlineCallback callback, void* user)
+{
+  ucvector idat;
+  const unsigned char* idatdata;
+  size_t idatsize;
+  ScanlineSink s;
+  InflateSink sink;
+  LodePNGDecompressSettings zlibsettings;
+
+  ucvector_init(&idat);
+  readChunks(&idat, &idatdata, &idatsize, w, h, state, in, insize);
+  if(!state->error && state->info_png.interlace_method != 0) state->error = 95; /*interlaced*/
+
+  s.line = 0;
+  if(!state->error)
+  {
+    s.size = lodepng_get_raw_size_idat(*w, 1, &state->info_png.color) + 1;
+    s.h = *h;
+    s.line = (unsigned char*)lodepng_malloc(s.size);
+    s.fill = 0;
+    s.y = 0;
+    s.callback = callback;
+    s.user = user;
+    if(!s.line) state->error = 83; /*alloc fail*/
+  }
+  if(!state->error)
+  {
+    sink.write = scanlineSinkWrite;
+    sink.user = &s;
+    /*only used by the custom inflaters, which give the output in one piece*/
+    zlibsettings = state->decoder.zlibsettings;
+    zlibsettings.expected_size = s.size * s.h;
+    state->error = zlib_decompress_sink(idatdata, idatsize, &zlibsettings, &sink);
+    if(!state->error && (s.y != s.h || s.fill != 0)) state->error = 91; /*decompressed size doesn't match prediction*/
+  }
+
+  lodepng_free(s.line);
+  ucvector_cleanup(&idat);
+  return state->error;
+}
+
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                   unsigned w, const LodePNGColorMode* color)
+{
+  unsigned bpp = lodepng_get_bpp(color);
+  return unfilterScanline(recon, &scanline[1], precon, (bpp + 7) / 8, scanline[0], ((size_t)w * bpp + 7) / 8);
+}
+
+/*lodepng_decode_rows on top of lodepng_inflate_scanlines: unfilters and converts each scanline for the callback*/
+typedef struct RowDecoder
+{
+  const LodePNGColorMode* color;
+  unsigned w;
+  unsigned char* recon; /*the scanline being unfiltered*/
+  unsigned char* prevrecon; /*the previous scanline, unfiltered*/
+  const unsigned* channels;
+  unsigned numplanes;
+  unsigned char** rows; /*one row of w bytes per plane*/
+  LodePNGRowCallback callback;
+  void* user;
+} RowDecoder;
+
+static unsigned rowDecoderScanline(void* user, unsigned y, const unsigned char* scanline, size_t size)
+{
+  RowDecoder* d = (RowDecoder*)user;
+  unsigned char* swap;
+  unsigned error = lodepng_unfilter_scanline(d->recon, scanline, y == 0 ? 0 : d->prevrecon, d->w, d->color);
+  (void)size;
+  if(!error) error = lodepng_convert_planes(d->rows, d->channels, d->numplanes, d->recon, d->color, d->w, 1);
+  if(!error) error = d->callback(d->user, y, d->w, (const unsigned char* const*)d->rows);
+
+  swap = d->prevrecon;
+  d->prevrecon = d->recon;
+  d->recon = swap;
+  return error;
+}
+
+unsigned lodepng_decode_rows(const unsigned* channels, unsigned numplanes,
+                             unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user)
+{
+  RowDecoder d;
+  size_t linebytes;
+  unsigned k;
+
+  if(lodepng_inspect(w, h, state, in, insize)) return state->error;
+
+  if(state->info_png.interlace_method != 0)
+  {
+    /*the Adam7 passes each cover the whole image, so the rows are only complete once all of it is decoded*/
+    unsigned char* planes[4] = {0, 0, 0, 0};
+    const unsigned char* rows[4];
+    unsigned y;
+    if(numplanes > 4) return 56; /*unsupported color mode conversion*/
+    if(lodepng_decode_planes(planes, channels, numplanes, w, h, state, in, insize)) return state->error;
+    for(y = 0; y != *h && !state->error; ++y)
     {
-      state->error = 83; /*alloc fail*/
+      for(k = 0; k != numplanes; ++k) rows[k] = &planes[k][(size_t)y * (*w)];
+      state->error = callback(user, y, *w, rows);
     }
-    else state->error = lodepng_convert(*out, data, &state->info_raw,
-                                        &state->info_png.color, *w, *h);
-    lodepng_free(data);
+    for(k = 0; k != numplanes; ++k) lodepng_free(planes[k]);
+    return state->error;
+  }
+
+  /*the header says how long the scanlines are, the rest of the color mode (the palette) is only known once
+  lodepng_inflate_scanlines has read the chunks, which is before the first scanline*/
+  linebytes = lodepng_get_raw_size_idat(*w, 1, &state->info_png.color);
+  d.color = &state->info_png.color;
+  d.w = *w;
+  d.recon = (unsigned char*)lodepng_malloc(linebytes);
+  d.prevrecon = (unsigned char*)lodepng_malloc(linebytes);
+  d.channels = channels;
+  d.numplanes = numplanes;
+  d.rows = (unsigned char**)lodepng_malloc(numplanes * sizeof(unsigned char*));
+  d.callback = callback;
+  d.user = user;
+  if(!d.recon || !d.prevrecon || !d.rows) state->error = 83; /*alloc fail*/
+  for(k = 0; k != numplanes && d.rows; ++k) d.rows[k] = 0;
+  for(k = 0; k != numplanes && !state->error; ++k)
+  {
+    d.rows[k] = (unsigned char*)lodepng_malloc(*w);
+    if(!d.rows[k]) state->error = 83; /*alloc fail*/
+  }
+  for(k = 0; k != numplanes && !state->error; ++k)
+  {
+    if(channels[k] > 3) state->error = 56; /*unsupported color mode conversion*/
+  }
+
+  if(!state->error) lodepng_inflate_scanlines(w, h, state, in, insize, rowDecoderScanline, &d);
+
+  if(d.rows)
+  {
+    for(k = 0; k != numplanes; ++k) lodepng_free(d.rows[k]);
   }
+  lodepng_free(d.rows);
+  lodepng_free(d.recon);
+  lodepng_free(d.prevrecon);
   return state->error;
 }
 
@@ -4728,6 +6587,12 @@ void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
   lodepng_decompress_settings_init(&settings->zlibsettings);
 }
 
+void lodepng_decoder_settings_trusted(LodePNGDecoderSettings* settings)
+{
+  settings->ignore_crc = 1;
+  settings->zlibsettings.ignore_adler32 = 1;
+}
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #if defined(LODEPNG_COMPILE_DECODER) || defined(LODEPNG_COMPILE_ENCODER)
@@ -5148,121 +7013,106 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
   if(bpp == 0) return 31; /*error: invalid color type*/
 
-  if(strategy == LFS_ZERO)
+  if(strategy >= LFS_ZERO && strategy <= LFS_FOUR)
   {
+    unsigned char type = (unsigned char)strategy;
     for(y = 0; y != h; ++y)
     {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
-      out[outindex] = 0; /*filter type byte*/
-      filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, 0);
+      out[outindex] = type; /*filter type byte*/
+      filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, type);
       prevline = &in[inindex];
     }
   }
   else if(strategy == LFS_MINSUM)
   {
-    /*adaptive filtering*/
+    /*adaptive filtering: the costs of all five filters in one pass over the row, then only the cheapest one is
+    written. For differences, each byte is treated as signed, values above 127 are negative. Filtertype 0 isn't
+    a difference though, so it sums the unsigned bytes. This means filtertype 0 is almost never chosen, but that
+    is justified.*/
+    const PixelKernels* kernels = pixelKernels();
     size_t sum[5];
-    ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t smallest = 0;
-    unsigned char type, bestType = 0;
+    unsigned char type, bestType;
 
-    for(type = 0; type != 5; ++type)
+    for(y = 0; y != h; ++y)
     {
-      ucvector_init(&attempt[type]);
-      if(!ucvector_resize(&attempt[type], linebytes)) return 83; /*alloc fail*/
-    }
+      size_t outindex = (1 + linebytes) * y;
+      size_t inindex = linebytes * y;
+      kernels->filterSums(sum, &in[inindex], prevline, bytewidth, linebytes);
 
-    if(!error)
-    {
-      for(y = 0; y != h; ++y)
+      /*the first of the smallest sums*/
+      bestType = 0;
+      for(type = 1; type != 5; ++type)
       {
-        /*try the 5 filter types*/
-        for(type = 0; type != 5; ++type)
-        {
-          filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
-
-          /*calculate the sum of the result*/
-          sum[type] = 0;
-          if(type == 0)
-          {
-            for(x = 0; x != linebytes; ++x) sum[type] += (unsigned char)(attempt[type].data[x]);
-          }
-          else
-          {
-            for(x = 0; x != linebytes; ++x)
-            {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              unsigned char s = attempt[type].data[x];
-              sum[type] += s < 128 ? s : (255U - s);
-            }
-          }
-
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum[type] < smallest)
-          {
-            bestType = type;
-            smallest = sum[type];
-          }
-        }
-
-        prevline = &in[y * linebytes];
-
-        /*now fill the out values*/
-        out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
+        if(sum[type] < sum[bestType]) bestType = type;
       }
-    }
 
-    for(type = 0; type != 5; ++type) ucvector_cleanup(&attempt[type]);
+      out[outindex] = bestType; /*the first byte of a scanline will be the filter type*/
+      filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, bestType);
+      prevline = &in[inindex];
+    }
   }
   else if(strategy == LFS_ENTROPY)
   {
+    /*
+    The filter whose bytes, with the filter type byte, have the least entropy. The histograms of all five
+    filters are counted in one pass over the row, without writing any of them. For n = linebytes + 1 bytes with
+    counts c, n times the entropy is n log2(n) minus the sum of c log2(c), so the filter with the largest sum of
+    c log2(c) wins, and that comes from a table of c log2(c) made once per image. flog2 only approximates log2,
+    so on near ties this can pick another filter than the entropy in floats would.
+    */
+    size_t n = linebytes + 1;
+    float* clogc = (float*)lodepng_malloc(sizeof(float) * (n + 1));
+    unsigned* count = (unsigned*)lodepng_malloc(sizeof(unsigned) * 5 * 256);
     float sum[5];
-    ucvector attempt[5]; /*five filtering attempts, one for each filter type*/
-    float smallest = 0;
-    unsigned type, bestType = 0;
-    unsigned count[256];
+    unsigned type, bestType;
 
-    for(type = 0; type != 5; ++type)
+    if(!clogc || !count) error = 83; /*alloc fail*/
+    if(!error)
     {
-      ucvector_init(&attempt[type]);
-      if(!ucvector_resize(&attempt[type], linebytes)) return 83; /*alloc fail*/
+      clogc[0] = 0;
+      for(x = 1; x <= n; ++x) clogc[x] = x * flog2((float)x);
     }
 
-    for(y = 0; y != h; ++y)
+    for(y = 0; y != h && !error; ++y)
     {
-      /*try the 5 filter types*/
+      size_t outindex = (1 + linebytes) * y;
+      const unsigned char* scanline = &in[linebytes * y];
+      size_t i;
+
+      for(i = 0; i != 5 * 256; ++i) count[i] = 0;
+      for(i = 0; i != linebytes; ++i)
+      {
+        unsigned char value = scanline[i];
+        unsigned char a = i >= bytewidth ? scanline[i - bytewidth] : 0;
+        unsigned char b = prevline ? prevline[i] : 0;
+        unsigned char c = prevline && i >= bytewidth ? prevline[i - bytewidth] : 0;
+        ++count[value];
+        ++count[256 + (unsigned char)(value - a)];
+        ++count[512 + (unsigned char)(value - b)];
+        ++count[768 + (unsigned char)(value - (a + b) / 2)];
+        ++count[1024 + (unsigned char)(value - paethPredictor(a, b, c))];
+      }
+
+      bestType = 0;
       for(type = 0; type != 5; ++type)
       {
-        filterScanline(attempt[type].data, &in[y * linebytes], prevline, linebytes, bytewidth, type);
-        for(x = 0; x != 256; ++x) count[x] = 0;
-        for(x = 0; x != linebytes; ++x) ++count[attempt[type].data[x]];
-        ++count[type]; /*the filter type itself is part of the scanline*/
+        unsigned* typecount = &count[type * 256];
+        ++typecount[type]; /*the filter type itself is part of the scanline*/
         sum[type] = 0;
-        for(x = 0; x != 256; ++x)
-        {
-          float p = count[x] / (float)(linebytes + 1);
-          sum[type] += count[x] == 0 ? 0 : flog2(1 / p) * p;
-        }
-        /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-        if(type == 0 || sum[type] < smallest)
-        {
-          bestType = type;
-          smallest = sum[type];
-        }
+        for(x = 0; x != 256; ++x) sum[type] += clogc[typecount[x]];
+        /*the first of the largest sums*/
+        if(sum[type] > sum[bestType]) bestType = type;
       }
 
-      prevline = &in[y * linebytes];
-
-      /*now fill the out values*/
-      out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-      for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType].data[x];
+      out[outindex] = (unsigned char)bestType; /*the first byte of a scanline will be the filter type*/
+      filterScanline(&out[outindex + 1], scanline, prevline, linebytes, bytewidth, (unsigned char)bestType);
+      prevline = scanline;
     }
 
-    for(type = 0; type != 5; ++type) ucvector_cleanup(&attempt[type]);
+    lodepng_free(clogc);
+    lodepng_free(count);
   }
   else if(strategy == LFS_PREDEFINED)
   {
@@ -5903,6 +7753,8 @@ const char* lodepng_error_text(unsigned code)
     case 91: return "invalid decompressed idat size";
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
+    case 94: return "output buffer too small for the decoded image";
+    case 95: return "Adam7 interlaced images can't be inflated a scanline at a time";
   }
   return "unknown error code";
 }
@@ -6014,21 +7866,70 @@ State& State::operator=(const State& other)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const unsigned char* in,
-                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
+//DecodeOutput resizing std::vectors to hold the output after the first keep[index] bytes they already have
+struct VectorOutput
 {
-  unsigned char* buffer;
-  unsigned error = lodepng_decode_memory(&buffer, &w, &h, in, insize, colortype, bitdepth);
-  if(buffer && !error)
+  VectorOutput(std::vector<unsigned char>* vectors, unsigned count, bool append)
+    : vectors(vectors), keep(count, 0)
   {
-    State state;
-    state.info_raw.colortype = colortype;
-    state.info_raw.bitdepth = bitdepth;
-    size_t buffersize = lodepng_get_raw_size(w, h, &state.info_raw);
-    out.insert(out.end(), &buffer[0], &buffer[buffersize]);
-    lodepng_free(buffer);
+    if(append) for(unsigned k = 0; k != count; ++k) keep[k] = vectors[k].size();
   }
-  return error;
+
+  //back to what the vectors held before decoding, after an error
+  void restore()
+  {
+    for(size_t k = 0; k != keep.size(); ++k) vectors[k].resize(keep[k]);
+  }
+
+  std::vector<unsigned char>* vectors;
+  std::vector<size_t> keep;
+};
+
+static unsigned vectorOutput(void* user, unsigned index, unsigned char** buffer, size_t size)
+{
+  VectorOutput* output = (VectorOutput*)user;
+  std::vector<unsigned char>& vector = output->vectors[index];
+  try
+  {
+    vector.resize(output->keep[index] + size);
+  }
+  catch(...)
+  {
+    return 83; /*alloc fail*/
+  }
+  *buffer = &vector[output->keep[index]];
+  return 0;
+}
+
+static unsigned decodeVector(std::vector<unsigned char>& out, bool append, unsigned& w, unsigned& h,
+                             State& state, const unsigned char* in, size_t insize)
+{
+  VectorOutput output(&out, 1, append);
+  unsigned char* buffer = 0;
+  decodeImage(&buffer, &w, &h, &state, in, insize, vectorOutput, &output);
+  if(state.error) output.restore();
+  return state.error;
+}
+
+static unsigned decodePlaneVectors(std::vector<unsigned char>* planes, bool append,
+                                   const unsigned* channels, unsigned numplanes,
+                                   unsigned& w, unsigned& h, State& state,
+                                   const unsigned char* in, size_t insize)
+{
+  VectorOutput output(planes, numplanes, append);
+  std::vector<unsigned char*> buffers(numplanes ? numplanes : 1, (unsigned char*)0);
+  decodePlanes(channels, numplanes, &w, &h, &state, in, insize, vectorOutput, &output, &buffers[0]);
+  if(state.error) output.restore();
+  return state.error;
+}
+
+unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const unsigned char* in,
+                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
+{
+  State state;
+  state.info_raw.colortype = colortype;
+  state.info_raw.bitdepth = bitdepth;
+  return decodeVector(out, true, w, h, state, in, insize);
 }
 
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
@@ -6041,15 +7942,7 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
                 State& state,
                 const unsigned char* in, size_t insize)
 {
-  unsigned char* buffer = NULL;
-  unsigned error = lodepng_decode(&buffer, &w, &h, &state, in, insize);
-  if(buffer && !error)
-  {
-    size_t buffersize = lodepng_get_raw_size(w, h, &state.info_raw);
-    out.insert(out.end(), &buffer[0], &buffer[buffersize]);
-  }
-  lodepng_free(buffer);
-  return error;
+  return decodeVector(out, true, w, h, state, in, insize);
 }
 
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
@@ -6059,6 +7952,27 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
   return decode(out, w, h, state, in.empty() ? 0 : &in[0], in.size());
 }
 
+unsigned decode_planes(std::vector<unsigned char>* planes, const unsigned* channels, unsigned numplanes,
+                       unsigned& w, unsigned& h, State& state,
+                       const unsigned char* in, size_t insize)
+{
+  return decodePlaneVectors(planes, true, channels, numplanes, w, h, state, in, insize);
+}
+
+unsigned decode_into(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
+                     State& state,
+                     const unsigned char* in, size_t insize)
+{
+  return decodeVector(out, false, w, h, state, in, insize);
+}
+
+unsigned decode_planes_into(std::vector<unsigned char>* planes, const unsigned* channels, unsigned numplanes,
+                            unsigned& w, unsigned& h, State& state,
+                            const unsigned char* in, size_t insize)
+{
+  return decodePlaneVectors(planes, false, channels, numplanes, w, h, state, in, insize);
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const std::string& filename,
                 LodePNGColorType colortype, unsigned bitdepth)
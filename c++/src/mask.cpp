@@ -0,0 +1,105 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      mask.cpp
+   Description: Bit packed vegetation mask, one bit per pixel
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include "mask.h"
+
+
+// Number of set bits in a word
+static inline unsigned popcount64(uint64_t word)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(word);
+#else
+  word = word - ((word >> 1) & 0x5555555555555555ull);
+  word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+  word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+  return (unsigned) ((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+
+VegetationMask::VegetationMask()
+  : Width(0), Height(0)
+{
+}
+
+
+VegetationMask::VegetationMask(const int Width, const int Height)
+  : Width(0), Height(0)
+{
+  resize(Width, Height);
+}
+
+
+void VegetationMask::resize(const int Width, const int Height)
+{
+  this->Width = Width;
+  this->Height = Height;
+  bits.assign((size() + 63) / 64, 0);
+}
+
+
+size_t VegetationMask::count() const
+{
+  size_t total = 0;
+  for (size_t w=0; w<bits.size(); w++)
+    total += popcount64(bits[w]);
+  return total;
+}
+
+
+VegetationMask& VegetationMask::operator&=(const VegetationMask& other)
+{
+  for (size_t w=0; w<bits.size() && w<other.bits.size(); w++)
+    bits[w] &= other.bits[w];
+  return *this;
+}
+
+
+VegetationMask& VegetationMask::operator|=(const VegetationMask& other)
+{
+  for (size_t w=0; w<bits.size() && w<other.bits.size(); w++)
+    bits[w] |= other.bits[w];
+  return *this;
+}
+
+
+void VegetationMask::invert()
+{
+  for (size_t w=0; w<bits.size(); w++)
+    bits[w] = ~bits[w];
+  // keep the bits past the last pixel clear
+  if(size() % 64 != 0)
+    bits[bits.size() - 1] &= ((uint64_t) 1 << (size() % 64)) - 1;
+}
+
+
+std::vector<unsigned char> VegetationMask::toGrey1() const
+{
+  std::vector<unsigned char> output;
+  toGrey1(output);
+  return output;
+}
+
+
+// Byte b with its bit order reversed: the mask is least significant bit first, PNG is most significant first.
+// A constant table, so that any thread can use it without an initialisation to race on.
+#define REVERSE2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define REVERSE4(n) REVERSE2(n), REVERSE2(n + 2*16), REVERSE2(n + 1*16), REVERSE2(n + 3*16)
+#define REVERSE6(n) REVERSE4(n), REVERSE4(n + 2*4), REVERSE4(n + 1*4), REVERSE4(n + 3*4)
+static const unsigned char reversed[256] = { REVERSE6(0), REVERSE6(2), REVERSE6(1), REVERSE6(3) };
+#undef REVERSE2
+#undef REVERSE4
+#undef REVERSE6
+
+void VegetationMask::toGrey1(std::vector<unsigned char>& output) const
+{
+  // The mask words are one continuous bit stream of the rows, so each output byte is one mask byte
+  output.resize((size() + 7) / 8);
+  for (size_t byte=0; byte<output.size(); byte++)
+    output[byte] = reversed[(bits[byte >> 3] >> (8 * (byte & 7))) & 0xFF];
+}
@@ -0,0 +1,130 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      paralleldeflate.cpp
+   Description: PNG image data deflated in bands on the worker threads and stitched into one zlib stream
+   Language:    C++
+   Usage:
+                lodepng filters the scanlines and hands the whole of them to its custom_zlib, this one. The
+                bands are cut by bytes, not rows: deflate needs no row alignment, and a band that starts inside
+                a scanline still finds its matches in the window before it. Every band but the last ends with
+                an empty stored block (zlib's Z_SYNC_FLUSH), so it stops on a byte boundary and the parts are
+                simply concatenated. The bands only depend on the size of the data and of the pool, so a given
+                number of threads always writes the same file.
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <string.h>
+#include <vector>
+#include "arena.h"
+#include "paralleldeflate.h"
+
+
+// One band of the input and its deflated part
+struct DeflateBand
+{
+  size_t start, end;
+  unsigned char* data;
+  size_t size;
+  unsigned adler;
+  unsigned error;
+};
+
+struct DeflateBands
+{
+  const unsigned char* in;
+  const LodePNGCompressSettings* settings;
+  const ParallelDeflate* parallel;
+  std::vector<DeflateBand> bands;
+};
+
+// A worker allocates from the encoding thread's arena for the time of the task, so the parts are pooled
+// with the rest of the frame
+static void deflateBand(void* arg, int index, int)
+{
+  DeflateBands* job = (DeflateBands*) arg;
+  DeflateBand& band = job->bands[index];
+  FrameArena* previous = frameArena();
+  useFrameArena(job->parallel->arena);
+
+  unsigned final = (size_t) index + 1 == job->bands.size();
+  if(job->parallel->codec && job->parallel->codec->deflatePart)
+    band.error = job->parallel->codec->deflatePart(&band.data, &band.size, job->in, band.start, band.end, final,
+                                                   job->settings);
+  else
+    band.error = lodepng_deflate_part(&band.data, &band.size, job->in, band.start, band.end, final, job->settings);
+  band.adler = lodepng_adler32(job->in + band.start, band.end - band.start);
+
+  useFrameArena(previous);
+}
+
+
+unsigned parallelZlibCompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize,
+                              const LodePNGCompressSettings* settings)
+{
+  const ParallelDeflate* parallel = (const ParallelDeflate*) settings->custom_context;
+  int workers = parallel->pool ? parallel->pool->size() : 1;
+
+  // a few bands per worker to even out their speeds, but none so small that the band ends cost much
+  const size_t MIN_BAND = 256 * 1024;
+  size_t count = (size_t) workers * 4;
+  if(count > insize / MIN_BAND)
+    count = insize / MIN_BAND;
+  if(count < 1)
+    count = 1;
+
+  DeflateBands job;
+  job.in = in;
+  job.settings = settings;
+  job.parallel = parallel;
+  job.bands.resize(count);
+  for (size_t i=0; i<count; i++){
+    DeflateBand& band = job.bands[i];
+    band.start = insize / count * i;
+    band.end = i + 1 == count ? insize : insize / count * (i + 1);
+    band.data = 0;
+    band.size = 0;
+    band.adler = 1;
+    band.error = 0;
+  }
+  runTasks(parallel->pool, deflateBand, &job, (int) count);
+
+  // the first error in band order, else the parts in band order between the zlib header lodepng writes
+  // (CMF 0x78 for deflate with a 32KB window, FLG 0x01 to make it a multiple of 31) and the Adler32
+  unsigned error = 0;
+  size_t total = *outsize + 2 + 4;
+  unsigned adler = 1;
+  for (size_t i=0; i<count; i++){
+    const DeflateBand& band = job.bands[i];
+    if(!error)
+      error = band.error;
+    total += band.size;
+    adler = lodepng_adler32_combine(adler, band.adler, band.end - band.start);
+  }
+
+  unsigned char* data = error ? 0 : (unsigned char*) lodepng_realloc(*out, total);
+  if(!error && !data)
+    error = 83;
+  if(!error){
+    size_t size = *outsize;
+    data[size++] = 0x78;
+    data[size++] = 0x01;
+    for (size_t i=0; i<count; i++){
+      memcpy(data + size, job.bands[i].data, job.bands[i].size);
+      size += job.bands[i].size;
+    }
+    for (int shift=24; shift>=0; shift-=8)
+      data[size++] = (unsigned char) (adler >> shift);
+    *out = data;
+    *outsize = size;
+  }
+
+  for (size_t i=0; i<count; i++)
+    lodepng_free(job.bands[i].data);
+  return error;
+}
+
+
+void useParallelDeflate(const ParallelDeflate& parallel, LodePNGState* state)
+{
+  state->encoder.zlibsettings.custom_zlib = parallelZlibCompress;
+  state->encoder.zlibsettings.custom_context = &parallel;
+}
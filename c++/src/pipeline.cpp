@@ -0,0 +1,222 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      pipeline.cpp
+   Description: PNG decode split over two threads, one inflating the scanlines and one unfiltering them
+   Language:    C++
+   Usage:
+                The producer thread runs lodepng_inflate_scanlines and copies every filtered scanline into
+                a ring of slots. The calling thread takes them in order, unfilters each against the row
+                before it, converts it to the planes and hands the rows to the callback. Each side only
+                sleeps when the ring is empty or full, and is then woken once a quarter of the ring is
+                ready again, so the threads meet a few times per ring rather than once per row.
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <pthread.h>
+#include <string.h>
+#include <vector>
+#include "arena.h"
+#include "pipeline.h"
+
+
+// Ring of equally sized scanline slots between one producer and one consumer
+class ScanlineRing
+{
+public:
+  explicit ScanlineRing(size_t size);
+  ~ScanlineRing();
+
+  // Producer: copy the next scanline into the ring, waiting for a free slot. Returns the consumer's
+  // error once it has stopped, 0 otherwise.
+  unsigned push(const unsigned char* scanline);
+  // Producer: no more scanlines will come
+  void close();
+
+  // Consumer: the oldest scanline, waiting for one, or 0 once the ring is closed and empty
+  const unsigned char* front();
+  // Consumer: release the scanline front() returned
+  void pop();
+  // Consumer: stop taking scanlines, the next push returns error
+  void stop(unsigned error);
+
+private:
+  std::vector<unsigned char> data;
+  size_t size, slots, batch;
+  size_t head, tail, filled; // next slot to read and to write, slots in use
+  bool closed;
+  unsigned stopped;
+  pthread_mutex_t mutex;
+  pthread_cond_t notEmpty, notFull;
+
+  ScanlineRing(const ScanlineRing&);
+  ScanlineRing& operator=(const ScanlineRing&);
+};
+
+
+ScanlineRing::ScanlineRing(size_t size)
+  : size(size), head(0), tail(0), filled(0), closed(false), stopped(0)
+{
+  const size_t RING_BYTES = 1 << 20;
+  slots = RING_BYTES / size;
+  if(slots < 8)
+    slots = 8;
+  if(slots > 256)
+    slots = 256;
+  batch = slots / 4;
+  data.resize(slots * size);
+
+  pthread_mutex_init(&mutex, 0);
+  pthread_cond_init(&notEmpty, 0);
+  pthread_cond_init(&notFull, 0);
+}
+
+
+ScanlineRing::~ScanlineRing()
+{
+  pthread_cond_destroy(&notFull);
+  pthread_cond_destroy(&notEmpty);
+  pthread_mutex_destroy(&mutex);
+}
+
+
+unsigned ScanlineRing::push(const unsigned char* scanline)
+{
+  pthread_mutex_lock(&mutex);
+  if(filled == slots)
+    while(!stopped && filled > slots - batch)
+      pthread_cond_wait(&notFull, &mutex);
+  unsigned error = stopped;
+  pthread_mutex_unlock(&mutex);
+  if(error)
+    return error;
+
+  // the slot is the producer's until filled counts it, so the copy needs no lock
+  memcpy(&data[tail * size], scanline, size);
+  tail = (tail + 1) % slots;
+
+  pthread_mutex_lock(&mutex);
+  // the consumer only sleeps on an empty ring, so filled passes batch on the way up
+  if(++filled == batch)
+    pthread_cond_signal(&notEmpty);
+  pthread_mutex_unlock(&mutex);
+  return 0;
+}
+
+
+void ScanlineRing::close()
+{
+  pthread_mutex_lock(&mutex);
+  closed = true;
+  pthread_cond_signal(&notEmpty);
+  pthread_mutex_unlock(&mutex);
+}
+
+
+const unsigned char* ScanlineRing::front()
+{
+  pthread_mutex_lock(&mutex);
+  if(filled == 0)
+    while(!closed && filled < batch)
+      pthread_cond_wait(&notEmpty, &mutex);
+  bool empty = filled == 0;
+  pthread_mutex_unlock(&mutex);
+  return empty ? 0 : &data[head * size];
+}
+
+
+void ScanlineRing::pop()
+{
+  head = (head + 1) % slots;
+  pthread_mutex_lock(&mutex);
+  // the producer only sleeps on a full ring, so filled passes slots - batch on the way down
+  if(filled-- == slots - batch + 1)
+    pthread_cond_signal(&notFull);
+  pthread_mutex_unlock(&mutex);
+}
+
+
+void ScanlineRing::stop(unsigned error)
+{
+  pthread_mutex_lock(&mutex);
+  stopped = error;
+  pthread_cond_signal(&notFull);
+  pthread_mutex_unlock(&mutex);
+}
+
+
+// The inflating thread. It has its own width and height, the consumer reads those lodepng_inspect gave,
+// and allocates from the caller's frame arena.
+struct Producer
+{
+  LodePNGState* state;
+  const unsigned char* in;
+  size_t insize;
+  unsigned w, h;
+  ScanlineRing* ring;
+  FrameArena* arena;
+};
+
+static unsigned pushScanline(void* ring, unsigned, const unsigned char* scanline, size_t)
+{
+  return ((ScanlineRing*) ring)->push(scanline);
+}
+
+static void* producerMain(void* arg)
+{
+  Producer* p = (Producer*) arg;
+  useFrameArena(p->arena);
+  lodepng_inflate_scanlines(&p->w, &p->h, p->state, p->in, p->insize, pushScanline, p->ring);
+  p->ring->close();
+  return 0;
+}
+
+
+unsigned decodeRowsPipelined(const unsigned* channels, unsigned numplanes, unsigned& w, unsigned& h,
+                             LodePNGState& state, const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user)
+{
+  if(lodepng_inspect(&w, &h, &state, in, insize))
+    return state.error;
+  if(state.info_png.interlace_method != 0)
+    return lodepng_decode_rows(channels, numplanes, &w, &h, &state, in, insize, callback, user);
+  for (unsigned k=0; k<numplanes; k++)
+    if(channels[k] > 3)
+      return state.error = 56; // unsupported color mode conversion
+
+  size_t linebytes = ((size_t) w * lodepng_get_bpp(&state.info_png.color) + 7) / 8;
+  ScanlineRing ring(linebytes + 1);
+  Producer producer = { &state, in, insize, 0, 0, &ring, frameArena() };
+  pthread_t thread;
+  if(pthread_create(&thread, 0, producerMain, &producer) != 0)
+    return lodepng_decode_rows(channels, numplanes, &w, &h, &state, in, insize, callback, user);
+
+  std::vector<unsigned char> recon(linebytes), prevrecon(linebytes);
+  std::vector<unsigned char> rowdata((size_t) numplanes * w + 1);
+  std::vector<unsigned char*> rows(numplanes + 1);
+  for (unsigned k=0; k<numplanes; k++)
+    rows[k] = &rowdata[(size_t) k * w];
+
+  // The producer read the chunks before it pushed the first scanline, so from then on state.info_png
+  // has the palette too. It writes nothing of state but state.error afterwards.
+  unsigned error = 0;
+  unsigned y = 0;
+  while(const unsigned char* scanline = ring.front()){
+    error = lodepng_unfilter_scanline(&recon[0], scanline, y == 0 ? 0 : &prevrecon[0], w, &state.info_png.color);
+    ring.pop();
+    if(!error)
+      error = lodepng_convert_planes(&rows[0], channels, numplanes, &recon[0], &state.info_png.color, w, 1);
+    if(!error)
+      error = callback(user, y, w, &rows[0]);
+    if(error){
+      ring.stop(error);
+      break;
+    }
+    recon.swap(prevrecon);
+    y++;
+  }
+  pthread_join(thread, 0);
+
+  // the consumer's error first, the producer then only reports that it was stopped
+  if(error)
+    state.error = error;
+  return state.error;
+}
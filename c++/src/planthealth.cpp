@@ -21,10 +21,19 @@
 // Includes
 #include <getopt.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <cstdlib>
 #include <iostream>
 #include <vector>
+#include "analysis.h"
+#include "arena.h"
+#include "codecs.h"
+#include "kernels.h"
+#include "paralleldeflate.h"
+#include "pipeline.h"
+#include "threadpool.h"
+#include "timings.h"
 #include "lodepng.h" // The only non standard dependency is lightweight lodepng module: http://lodev.org/lodepng/
 
 
@@ -33,198 +42,142 @@ static int debug=0;
 
 
 // Load a PNG File from Disk
-// The pixels are now in the vector "image", 4 bytes per pixel, ordered RGBARGBA
-void loadPNG(const char* filename, std::vector<unsigned char>& image, int& Width, int& Height)
+// Only the IR (red channel) and blue planes are kept, Width * Height bytes each. They are converted
+// straight from the decoded scanlines, so the full RGBA image is never built. Pipelined, the inflate runs
+// on a second thread while this one unfilters and copies the rows (see pipeline.h).
+struct PlaneRows
 {
-  unsigned width, height;
+  unsigned char* planes[2];
+};
 
-  //decode
-  unsigned error = lodepng::decode(image, width, height, filename);
-
-  Width = (int) width;
-  Height = (int) height;
-
-  //if there's an error, display it
-  if(error) std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
-}
-
-
-// Save a PNG Image to the supplied filename
-// The image argument has width * height RGBA pixels or width * height * 4 bytes
-void savePNG(const char* filename, const std::vector<unsigned char>& image, unsigned width, unsigned height)
+static unsigned copyRow(void* planeRows, unsigned y, unsigned w, const unsigned char* const* rows)
 {
-  //Encode the image
-  unsigned error = lodepng::encode(filename, image, width, height);
-
-  //if there's an error, display it
-  if(error) std::cout << "encoder error " << error << ": "<< lodepng_error_text(error) << std::endl;
+  PlaneRows* p = (PlaneRows*) planeRows;
+  for (int k=0; k<2; k++)
+    memcpy(p->planes[k] + (size_t) y * w, rows[k], w);
+  return 0;
 }
 
-
-// Otsu Method for Automatic Thresholding
-// from: http://www.labbookpages.co.uk/software/imgProc/otsuThreshold.html
-int otsu_threshold(const std::vector<float>& scaled, int Width, int Height)
+void loadPNG(const char* filename, std::vector<unsigned char>& ir, std::vector<unsigned char>& blue, int& Width, int& Height,
+             StageTimings* timings = 0, bool trusted = false, bool pipelined = false)
 {
-  // Calculate histogram
-  std::vector<int> histogram;
-  if(histogram.size() != 256) // check it is the right size
-    histogram.resize(256);
-  for(int i=0; i<256; i++) // Initialise Histogram bins to zero
-    histogram[i] = 0;
-  for (int dy=0; dy<Height; dy++){ // Now loop through the image and 
-    for (int dx=0; dx<Width; dx++){
-      int index = scaled[dy * Width + dx]; // Find the bin
-      if (index > 255 ) // make sure we are not out of bounds
-	printf("index too big: %d", index);
-      if (index < 0 )
-	printf("index too small: %d", index);
-      histogram[ index ]++; // Increment the bin frequency
+  unsigned width = 0, height = 0;
+  std::vector<unsigned char> png;
+  if(timings)
+    timings->start("read");
+  lodepng::load_file(png, filename);
+  if(timings)
+    timings->stop(png.size(), 0);
+
+  //decode the IR (channel 0) and blue (channel 2) planes
+  if(timings)
+    timings->start("decode");
+  //straight into the caller's vectors, which keep their capacity from an earlier frame
+  lodepng::State state;
+  usePNGCodec(pngCodec(), &state);
+  if(trusted)
+    lodepng_decoder_settings_trusted(&state.decoder);
+  const unsigned channels[2] = { 0, 2 };
+  unsigned error = png.empty() ? 78 : lodepng_inspect(&width, &height, &state, &png[0], png.size());
+  if(!error){
+    try{
+      ir.resize((size_t) width * height);
+      blue.resize((size_t) width * height);
     }
-  }
-    
-  // Total number of pixels
-  int total = scaled.size();
-
-  // Now calculate the Otsu Threshold
-  float sum = 0.0;
-  for (int t=0 ; t<256 ; t++) sum += t * histogram[t];
-  
-  float sumB = 0.0;
-  int wB = 0;
-  int wF = 0;
- 
-  float varMax = 0.0;
-  int threshold = 0;
-  
-  for (int t=0 ; t<256 ; t++) {
-    wB += histogram[t];               // Weight Background
-    if (wB == 0) continue;
-    
-    wF = total - wB;                 // Weight Foreground
-    if (wF == 0) break;
-    
-    sumB += (float) (t * histogram[t]);
-    
-    float mB = sumB / wB;            // Mean Background
-    float mF = (sum - sumB) / wF;    // Mean Foreground
-   
-    // Calculate Between Class Variance
-    float varBetween = (float)wB * (float)wF * (mB - mF) * (mB - mF);
-   
-    // Check if new maximum found
-    if (varBetween > varMax) {
-      varMax = varBetween;
-      threshold = t;
+    catch(...){
+      error = 83; // lodepng's "memory allocation failed", the header can claim any size
     }
   }
-  return threshold;
-}
-
-
-// Calculate the NDVI image from the original IRGB image 
-std::vector<float> calculateNDVI(const std::vector<unsigned char>& image, const int Width, const int Height)
-{
-  int irchannel=0;
-  int bluechannel=2;
-  std::vector<float> ndvi_raw;
-  ndvi_raw.resize(Width*Height);
-  // Do the NDVI calculation
-  for (int dy=0; dy<Height; dy++){ 
-    for (int dx=0; dx<Width; dx++){
-      float irpixel = (float) image[4* dy * Width + 4 * dx + irchannel];
-      float bluepixel = (float) image[4 * dy * Width + 4 * dx + bluechannel];
-      float numerator = (irpixel - bluepixel);
-      float denominator = (irpixel + bluepixel);
-      float pixel = (numerator / denominator);
-      ndvi_raw[dy * Width + dx] = pixel;
+  if(!error){
+    if(pipelined){
+      PlaneRows planeRows = { { &ir[0], &blue[0] } };
+      error = decodeRowsPipelined(channels, 2, width, height, state, &png[0], png.size(), copyRow, &planeRows);
     }
-  }
-  return ndvi_raw;
-} 
-
-
-// Calculate the minimum and maximum pixel values in an image
-void minMax(const std::vector<float>& image, const int Width, const int Height, float& min, float& max)
-{
-  // Calculate the min and max values:  
-  for (int dy=0; dy<Height; dy++){
-    for (int dx=0; dx<Width; dx++){
-      if(image[dy * Width + dx] < min) 
-	min = image[dy * Width + dx];
-      if(max < image[dy * Width + dx]) 
-	max = image[dy * Width + dx];
+    else{
+      unsigned char* planes[2] = { &ir[0], &blue[0] };
+      error = lodepng_decode_planes_into(planes, ir.size(), channels, 2, &width, &height, &state,
+                                         &png[0], png.size());
     }
   }
+  if(timings)
+    timings->stop(png.size(), (size_t) width * height);
 
+  Width = (int) width;
+  Height = (int) height;
+
+  //if there's an error, display it
+  if(error) std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
 }
 
 
-// Scale a float image into the normal 0-255 greyscale range
-std::vector<float> scaleImage(const std::vector<float>& image, const int Width, const int Height, const float min, const float max)
+// Stream a PNG File from Disk into the accumulator
+// Each row of the IR and blue planes is added as soon as it is decoded, so the decoded frame is never held
+// in memory, only the PNG file and a few rows. Pipelined, the rows are added while the next ones are
+// inflated on a second thread.
+static unsigned addRow(void* accumulator, unsigned, unsigned w, const unsigned char* const* rows)
 {
-  double data_black = min;
-  double data_white = max;
-  double range = data_white - data_black;
-  
-  std::vector<float> scaled;
-  scaled.resize(Width*Height);
-  for (int dy=0; dy<Height; dy++){
-    for (int dx=0; dx<Width; dx++){
-      scaled[dy * Width + dx] = (float) (((image[dy * Width + dx] - data_black)/range) * 255);
-    }
-  }
-  return scaled;
+  ((NDVIAccumulator*) accumulator)->addRow(rows[0], rows[1], (int) w);
+  return 0;
 }
 
-
-// Threshold a greyscale image
- std::vector<int> thresholdImage(const std::vector<float>& image, const int Width, const int Height, const int threshold)
+void streamPNG(const char* filename, NDVIAccumulator& accumulator, int& Width, int& Height,
+               StageTimings* timings = 0, bool trusted = false, bool pipelined = false)
 {
-  std::vector<int> bitmap;
-  bitmap.resize(Width*Height); // make sure we have space
-  for (int dy=0; dy<Height; dy++){
-    for (int dx=0; dx<Width; dx++){
-      if(image[dy * Width + dx] >= threshold)
-	bitmap[dy * Width + dx] = 255;
-      else
-	bitmap[dy * Width + dx] = 0;
-    }
-  }
-  return bitmap;
-}
+  unsigned width = 0, height = 0;
+  std::vector<unsigned char> png;
+  if(timings)
+    timings->start("read");
+  lodepng::load_file(png, filename);
+  if(timings)
+    timings->stop(png.size(), 0);
+
+  //decode the IR (channel 0) and blue (channel 2) planes a row at a time
+  if(timings)
+    timings->start("decode_histogram");
+  lodepng::State state;
+  usePNGCodec(pngCodec(), &state);
+  if(trusted)
+    lodepng_decoder_settings_trusted(&state.decoder);
+  const unsigned channels[2] = { 0, 2 };
+  unsigned error = png.empty() ? 78 :
+                   pipelined ? decodeRowsPipelined(channels, 2, width, height, state, &png[0], png.size(),
+                                                   addRow, &accumulator) :
+                   lodepng_decode_rows(channels, 2, &width, &height, &state, &png[0], png.size(), addRow, &accumulator);
+  if(timings)
+    timings->stop(png.size(), (size_t) width * height);
 
+  Width = (int) width;
+  Height = (int) height;
 
-// Convert a greyscale (0-255) image to RGB
-// Output will be 3 identical channels plus alpha in 4 byte RGBARGBA format
-template<typename T>
-std::vector<unsigned char> greyscale2RGB(const std::vector<T>& image, const int Width, const int Height)
-{
-  std::vector<unsigned char> output;
-  output.resize(Width * Height * 4); // Output image will by 4x bigger than the input
-  
-  for (int dy=0; dy<Height; dy++){
-    for (int dx=0; dx<Width; dx++){
-      output[4 * Width * dy + 4 * dx + 0] = (unsigned char) image[dy * Width + dx];
-      output[4 * Width * dy + 4 * dx + 1] =  (unsigned char) image[dy * Width + dx];
-      output[4 * Width * dy + 4 * dx + 2] =  (unsigned char) image[dy * Width + dx];
-      output[4 * Width * dy + 4 * dx + 3] =  (unsigned char) 255;
-    }
-  }
-  return output;
+  //if there's an error, display it
+  if(error) std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
 }
 
 
-// Reduce the NDVI into a single relative metric by summing over all vegetation pixels
-float sumVegetationIndex(const std::vector<float>&ndvi_raw, const std::vector<int>& bitmap, const int Width, const int Height)
+// Save a PNG Image to the supplied filename
+// The image argument is written as it is, in the PNG color type colortype and bitdepth (LCT_GREY, 8 for the
+// scaled NDVI, LCT_GREY, 1 for a packed mask); auto_convert is off, so no pass over the pixels picks one.
+// With a pool of more than one thread the image data is deflated in bands on all of them (see paralleldeflate.h).
+void savePNG(const char* filename, const std::vector<unsigned char>& image, unsigned width, unsigned height,
+             LodePNGColorType colortype, unsigned bitdepth, ThreadPool* pool)
 {
-  float sumVegIndex = 0.0;
-  for (int dy=0; dy<Height; dy++){
-    for (int dx=0; dx<Width; dx++){
-      if(bitmap[dy * Width + dx] == 255)
-	sumVegIndex += ndvi_raw[dy * Width + dx];
-    }
-  }
-  return sumVegIndex;
+  //Encode the image with the selected codec
+  lodepng::State state;
+  usePNGCodec(pngCodec(), &state);
+  usePNGLevel(pngLevel(), &state);
+  ParallelDeflate parallel = { pool, &pngCodec(), frameArena() };
+  if(pool && pool->size() > 1)
+    useParallelDeflate(parallel, &state);
+  state.encoder.auto_convert = 0;
+  state.info_raw.colortype = state.info_png.color.colortype = colortype;
+  state.info_raw.bitdepth = state.info_png.color.bitdepth = bitdepth;
+  std::vector<unsigned char> png;
+  unsigned error = lodepng::encode(png, image, width, height, state);
+  if(!error)
+    lodepng::save_file(png, filename);
+
+  //if there's an error, display it
+  if(error) std::cout << "encoder error " << error << ": "<< lodepng_error_text(error) << std::endl;
 }
 
 
@@ -232,13 +185,31 @@ float sumVegetationIndex(const std::vector<float>&ndvi_raw, const std::vector<in
 static int help(void)
 {
   fprintf(stderr, 
-	  "Usage: planthealth [-h] [-d] [-b] [-o output.png] input.png\n"
+	  "Usage: planthealth [-h] [-d] [-t] [-T] [-c codec] [-C] [-L level] [-H] [-s] [-j threads] [-b] [-o output.png]\n"
+          "                   input.png\n"
           "\t-h Display this help message.\n"
           "\t-d Verbose output.\n"
+          "\t-t, --timings Report the wall time, MB/s and megapixels/s of every stage on stderr.\n"
+          "\t-T, --trusted The input is a frame we captured ourselves: skip the PNG CRC and\n"
+          "\t   Adler32 checks. Corrupted data is then not reported, only use it for own files.\n"
+          "\t-c, --codec Deflate codec for reading and writing PNGs: %s (default %s).\n"
+          "\t-C, --codec-check Check that every codec decodes input.png to the same pixels, and\n"
+          "\t   that what each encodes decodes the same again, and that each rejects the same\n"
+          "\t   corrupted deflate streams as lodepng's inflater, then exit.\n"
+          "\t-L, --png-level Encoder preset for the output PNG: %s (default %s).\n"
+          "\t   store writes it uncompressed, fast trades size for speed, max the reverse.\n"
+          "\t-H Histogram mode: compute every statistic from the (IR, blue) histogram.\n"
+          "\t   Faster; the metric can differ from the default only by rounding.\n"
+          "\t-s Streaming mode: analyse the image a row at a time as it is decoded, so memory\n"
+          "\t   use does not grow with the image. Same metric as -H. Ignored with -o.\n"
+          "\t-j Number of analysis threads (default: one per processor).\n"
+          "\t   The metric is the same for any number of threads. With more than one, the PNG\n"
+          "\t   is inflated on a thread of its own while its rows are unfiltered and analysed,\n"
+          "\t   and the output PNG is deflated in bands on all of them.\n"
           "\t-b Output the bitmap image to [output] instead of the NDVI.\n"
           "\t-o Output the Scaled NDVI image to [output].\n"
           "\t   Input and Output images must be PNG Format.\n"
-          "Nick Arini 2014\n");
+          "Nick Arini 2014\n", pngCodecNames().c_str(), pngCodec().name, pngLevelNames().c_str(), pngLevel().name);
   exit(0);
 
 }
@@ -249,17 +220,63 @@ int main(int argc, char **argv) {
   int optch;
   int outputFlag=0;
   int outputBitmap=0;
-  char *b_opt_arg;
+  int histogramMode=0;
+  int streamMode=0;
+  int timingsFlag=0;
+  int trustedFlag=0;
+  int codecCheck=0;
+  int threads=ThreadPool::processors();
+  char *b_opt_arg = 0;
 
   // command line arguments
-  while ((optch = getopt(argc, argv, ":dhbo:")) != EOF)
+  static const struct option longopts[] = {
+    { "timings", no_argument, 0, 't' },
+    { "trusted", no_argument, 0, 'T' },
+    { "codec", required_argument, 0, 'c' },
+    { "codec-check", no_argument, 0, 'C' },
+    { "png-level", required_argument, 0, 'L' },
+    { 0, 0, 0, 0 }
+  };
+  while ((optch = getopt_long(argc, argv, ":dhtTc:CL:Hsj:bo:", longopts, 0)) != EOF)
     switch (optch) {
     case 'd':
       debug = 1;
       break;
+    case 't':
+      timingsFlag = 1;
+      break;
+    case 'T':
+      trustedFlag = 1;
+      break;
+    case 'c':
+      if(!selectPNGCodec(optarg)){
+        fprintf(stderr, "Unknown codec %s, built in: %s\n", optarg, pngCodecNames().c_str());
+        exit(1);
+      }
+      break;
+    case 'C':
+      codecCheck = 1;
+      break;
+    case 'L':
+      if(!selectPNGLevel(optarg)){
+        fprintf(stderr, "Unknown PNG level %s, presets: %s\n", optarg, pngLevelNames().c_str());
+        exit(1);
+      }
+      break;
     case 'h':
       help();
       break;
+    case 'H':
+      histogramMode=1;
+      break;
+    case 's':
+      streamMode=1;
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      if(threads < 1)
+        help();
+      break;
     case 'b':
       outputBitmap=1;
       break;
@@ -287,41 +304,64 @@ int main(int argc, char **argv) {
   // Grab the image from file
   //const char* filename = argc > 1 ? argv[1] : "image2.png";
   const char* filename =argv[optind];
-  std::vector<unsigned char> image; //the raw pixels
+
+  // Self check of the codecs on this file instead of the analysis
+  if(codecCheck){
+    std::vector<unsigned char> png;
+    lodepng::load_file(png, filename);
+    return checkPNGCodecs(png) ? 0 : 1;
+  }
+
+  // Every buffer of the frame, lodepng's included, comes from the arena
+  FrameArena arena;
+  useFrameArena(&arena);
+  std::vector<unsigned char>& ir = arena.ir; //the IR and blue planes
+  std::vector<unsigned char>& blue = arena.blue;
   int Width=0, Height=0;
-  loadPNG(filename, image, Width, Height);
-  if(debug)
-    printf("Filename %s loaded\n",filename);
-  
-  // Now calculate the NDVI Image
-  std::vector<float> ndvi_raw = calculateNDVI(image, Width, Height);
+  NDVIAnalysis& analysis = arena.analysis;
 
-  float min=0.0, max=0.0;
-  minMax(ndvi_raw, Width, Height, min, max);
+  // Stage timings for -t, reported on stderr at the end
+  StageTimings timing;
+  StageTimings* timings = timingsFlag ? &timing : 0;
 
-  if(debug){
-    printf("NDVI Calculated:\n");
-    printf("Min NDVI: %f\n", min);
-    printf("Max NDVI: %f\n", max);
+  // Worker threads for the row bands of the analysis, the main thread is one of them
+  ThreadPool pool(threads);
+
+  if(streamMode && !outputFlag){
+    // Only the metric is needed, so the (IR, blue) histogram is gathered while the image is decoded
+    NDVIAccumulator accumulator;
+    streamPNG(filename, accumulator, Width, Height, timings, trustedFlag, pool.size() > 1);
+    if(debug)
+      printf("Filename %s streamed\n",filename);
+    accumulator.finish(analysis, timings);
   }
-  
-  // Now we need to scale the image in our normal 0-255 range
-  // Keep the raw image because we need it later
-  std::vector<float> scaled = scaleImage(ndvi_raw, Width, Height, min, max);
+  else{
+    loadPNG(filename, ir, blue, Width, Height, timings, trustedFlag, pool.size() > 1);
+    if(debug){
+      printf("Filename %s loaded\n",filename);
+      printf("Using %s kernels for the band passes\n", ndviKernels().name);
+      printf("Using %s codec\n", pngCodec().name);
+      printf("Using %d threads\n", pool.size());
+    }
 
-  //now do the thresholding 
-  int threshold = otsu_threshold(scaled, Width, Height);
-  if(debug)
-    printf("Calculating Otsu Threshold: %d \n", threshold );
+    // Now calculate the NDVI, the Otsu threshold and the vegetation sum in one fused pass
+    if(histogramMode)
+      analyseNDVIHistogram(ir, blue, Width, Height, analysis, &pool, timings);
+    else
+      analyseNDVI(ir, blue, Width, Height, analysis, &pool, timings);
+  }
 
-  // Apply the threshold to the scaled image to create a bitmap which excludes non-vegetation
-  std::vector<int> bitmap = thresholdImage(scaled, Width, Height, threshold);
-  if(debug)
+  if(debug){
+    printf("NDVI Calculated:\n");
+    printf("Min NDVI: %f\n", analysis.min);
+    printf("Max NDVI: %f\n", analysis.max);
+    printf("Calculating Otsu Threshold: %d \n", analysis.threshold );
     printf("Thresholding Image\n");
+  }
 
-  // Loop through the original NVDI Raw image checking against the bitmap and summing the vegetation index over all plant pixels.
+  // The sum of the vegetation index over all plant pixels.
   // The higher this value the more overall photosynthesis is going on with the plant.
-  float totalVegIndex = sumVegetationIndex(ndvi_raw, bitmap, Width, Height);
+  float totalVegIndex = analysis.totalVegIndex;
   if(debug)
     printf ("Total Vegetation Index: %f\n", totalVegIndex);
   else
@@ -334,24 +374,57 @@ int main(int argc, char **argv) {
     if(debug)
       printf("Filename %s\n", filename2);
 
-    std::vector<unsigned char> outputimage;
-    if(outputBitmap)
-      outputimage = greyscale2RGB(bitmap, Width, Height);
-    else
-      outputimage = greyscale2RGB(scaled, Width, Height);
-    
-    if(debug)
-      printf("Encoding PNG Image %s\n", filename2);
-    
-    savePNG(filename2, outputimage, Width, Height);
+    // The scaled NDVI (or bitmap) is rendered from the per pair state of the analysis
+    // The scaled NDVI goes straight to an 8-bit greyscale PNG, the bitmap from the packed mask to a 1-bit one
+    const size_t npixels = (size_t) Width * Height;
+    if(outputBitmap){
+      if(timings)
+        timings->start("mask");
+      VegetationMask& bitmap = arena.mask;
+      std::vector<unsigned char>& grey1 = arena.grey1;
+      renderMask(ir, blue, Width, Height, analysis, bitmap, &pool);
+      bitmap.toGrey1(grey1);
+      if(timings)
+        timings->stop(2 * npixels, npixels);
+      if(debug)
+        printf("Encoding PNG Image %s (%lu vegetation pixels)\n", filename2, (unsigned long) bitmap.count());
+      if(timings)
+        timings->start("encode");
+      savePNG(filename2, grey1, Width, Height, LCT_GREY, 1, &pool);
+      if(timings)
+        timings->stop(grey1.size(), npixels);
+    }
+    else{
+      if(timings)
+        timings->start("render");
+      std::vector<unsigned char>& greyscale = arena.greyscale;
+      renderNDVI(ir, blue, Width, Height, analysis, greyscale, &pool);
+      if(timings)
+        timings->stop(2 * npixels, npixels);
+      if(debug)
+        printf("Encoding PNG Image %s\n", filename2);
+      if(timings)
+        timings->start("encode");
+      savePNG(filename2, greyscale, Width, Height, LCT_GREY, 8, &pool);
+      if(timings)
+        timings->stop(greyscale.size(), npixels);
+    }
 
     if(debug)
       printf("%s Saved\n", filename2);
   }
 
 
-  if(debug)
+  if(timings)
+    timings->report(stderr);
+
+  if(debug){
+    ArenaStats used = arena.stats();
+    printf("Arena: %lu of %lu allocations reused, %lu blocks (%lu bytes) from the heap\n",
+           (unsigned long) used.reused, (unsigned long) used.requests,
+           (unsigned long) used.heapAllocations, (unsigned long) used.heapBytes);
     printf("Done!\n");
+  }
   
   return 0;
   
@@ -0,0 +1,587 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      planthealth_bench.cpp
+   Description: Timed benchmarks of the planthealth stages, built and run with `make bench`
+   Language:    C++
+   Usage:
+                planthealth_bench [-i iterations] [-B seconds] [-j threads] [-s sizes] [-f frame.png]...
+
+                Every stage runs on a synthetic frame and on each -f frame tiled up to every size in the
+                list (megapixels, default 0.3,12; larger frames such as 50 MP only when asked for with -s).
+                A stage repeats for up to the given number of iterations or budget of seconds, at least 3
+                times, and one line is printed per frame and stage as
+                   bench frame=<name> MP=<size> stage=<stage> iterations=<n> median_ms=<t> p95_ms=<t>
+                         MP/s=<rate> B/px=<bytes>
+                B/px is the number of bytes the stage has to read and write per pixel, so MP/s * B/px is the
+                memory bandwidth it achieves. The reference stages and the band passes of the fused engine
+                use the kernels ndviKernels() picks, and every kernel set the CPU supports is also timed on
+                its own (e.g. stage=ndvi[scalar], stage=pairs[avx2]),
+                as is every PNG codec built in (e.g. stage=decode_planes[fast], see codecs.h).
+                stage=frame_arena processes a whole frame from a frame arena (see arena.h) and is followed by
+                   alloc frame=<name> MP=<size> stage=frame_arena first_heap_allocations=<n> ...
+                         steady_heap_allocations=<n> steady_heap_bytes=<n> steady_new=<n>
+                with the heap allocations of the first frame and of one after the arena is warm, which
+                should be none. stage=encode_level[<preset>] encodes the NDVI output with each encoder
+                preset (planthealth --png-level) and is followed by the size it came to,
+                   size frame=<name> MP=<size> stage=encode_level[<preset>] bytes=<n> bits_per_pixel=<b>
+                stage=encode_parallel encodes it with the default preset in bands on all -j threads (see
+                paralleldeflate.h) and is followed by its size too, to set against encode_level[default].
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+#include "analysis.h"
+#include "arena.h"
+#include "codecs.h"
+#include "kernels.h"
+#include "paralleldeflate.h"
+#include "pipeline.h"
+#include "threadpool.h"
+#include "timings.h"
+#include "lodepng.h"
+
+
+// A frame and every buffer the stages read and write, so that no stage result is optimised away
+struct Frame
+{
+  std::string name;
+  int Width, Height;
+  std::vector<unsigned char> image; // RGBA
+  std::vector<unsigned char> ir, blue;
+  std::vector<unsigned char> png, codecPng;
+  std::vector<float> ndvi, scaled;
+  std::vector<unsigned char> greyscale, rgba, grey1;
+  std::vector<uint16_t> pairs;
+  std::vector<unsigned char> flags;
+  VegetationMask bitmap;
+  float min, max, sum;
+  int threshold;
+  NDVIAnalysis analysis;
+  const NDVIKernels* kernels;
+  const PNGCodec* codec;
+  const PNGLevel* level;
+  FrameArena* arena;
+  ThreadPool* pool;
+
+  size_t pixels() const { return (size_t) Width * Height; }
+};
+
+typedef void (*StageFunction)(Frame& frame);
+
+
+// Every operator new is counted, so that with the arena stats the bench shows a frame processed from a
+// warm arena touches the heap not at all
+static size_t newCount = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+  __sync_fetch_and_add(&newCount, 1);
+  void* ptr = malloc(size ? size : 1);
+  if(!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) throw()
+{
+  free(ptr);
+}
+
+
+// Reference stages
+static void stageNDVI(Frame& f) { f.ndvi = calculateNDVI(f.image, f.Width, f.Height); }
+static void stageMinMax(Frame& f) { minMax(f.ndvi, f.Width, f.Height, f.min, f.max); }
+static void stageScale(Frame& f) { f.scaled = scaleImage(f.ndvi, f.Width, f.Height, f.min, f.max); }
+static void stageOtsu(Frame& f) { f.threshold = otsu_threshold(f.scaled, f.Width, f.Height); }
+static void stageThreshold(Frame& f) { f.bitmap = thresholdImage(f.scaled, f.Width, f.Height, f.threshold); }
+static void stageSum(Frame& f) { f.sum = sumVegetationIndex(f.ndvi, f.bitmap); }
+static void stageGreyscale2RGB(Frame& f) { f.rgba = greyscale2RGB(f.greyscale, f.Width, f.Height); }
+
+// lodepng
+static void stageEncode(Frame& f)
+{
+  f.png.clear();
+  lodepng::encode(f.png, f.image, f.Width, f.Height);
+}
+
+// The -o output: the scaled NDVI the way planthealth used to write it, expanded to RGBA for lodepng to
+// find it is greyscale again, then as it writes it now, straight from the greyscale and the packed mask
+static void encodeAs(std::vector<unsigned char>& png, const std::vector<unsigned char>& image, unsigned w, unsigned h,
+                     LodePNGColorType colortype, unsigned bitdepth)
+{
+  lodepng::State state;
+  state.encoder.auto_convert = 0;
+  state.info_raw.colortype = state.info_png.color.colortype = colortype;
+  state.info_raw.bitdepth = state.info_png.color.bitdepth = bitdepth;
+  png.clear();
+  lodepng::encode(png, image, w, h, state);
+}
+
+static void stageEncodeNDVIRGBA(Frame& f)
+{
+  greyscale2RGB(f.greyscale, f.Width, f.Height, f.rgba);
+  f.codecPng.clear();
+  lodepng::encode(f.codecPng, f.rgba, f.Width, f.Height);
+}
+static void stageEncodeNDVIGrey(Frame& f) { encodeAs(f.codecPng, f.greyscale, f.Width, f.Height, LCT_GREY, 8); }
+// The NDVI output with an encoder preset (see codecs.h)
+static void levelEncode(Frame& f)
+{
+  lodepng::State state;
+  usePNGLevel(*f.level, &state);
+  state.encoder.auto_convert = 0;
+  state.info_raw.colortype = state.info_png.color.colortype = LCT_GREY;
+  f.codecPng.clear();
+  lodepng::encode(f.codecPng, f.greyscale, f.Width, f.Height, state);
+}
+
+// The NDVI output with the default preset, deflated in bands on the pool (see paralleldeflate.h)
+static void stageEncodeParallel(Frame& f)
+{
+  lodepng::State state;
+  ParallelDeflate parallel = { f.pool, &pngCodec(), frameArena() };
+  useParallelDeflate(parallel, &state);
+  state.encoder.auto_convert = 0;
+  state.info_raw.colortype = state.info_png.color.colortype = LCT_GREY;
+  f.codecPng.clear();
+  lodepng::encode(f.codecPng, f.greyscale, f.Width, f.Height, state);
+}
+
+static void stageEncodeMaskGrey1(Frame& f)
+{
+  f.bitmap.toGrey1(f.grey1);
+  encodeAs(f.codecPng, f.grey1, f.Width, f.Height, LCT_GREY, 1);
+}
+
+static void stageDecode(Frame& f)
+{
+  unsigned w, h;
+  lodepng::State state;
+  lodepng::decode_into(f.rgba, w, h, state, &f.png[0], f.png.size());
+}
+
+static void decodePlanes(Frame& f, bool trusted)
+{
+  unsigned w, h;
+  lodepng::State state;
+  if(trusted)
+    lodepng_decoder_settings_trusted(&state.decoder);
+  std::vector<unsigned char> planes[2];
+  const unsigned channels[2] = { 0, 2 };
+  planes[0].swap(f.ir);
+  planes[1].swap(f.blue);
+  lodepng::decode_planes_into(planes, channels, 2, w, h, state, &f.png[0], f.png.size());
+  f.ir.swap(planes[0]);
+  f.blue.swap(planes[1]);
+}
+
+static void stageDecodePlanes(Frame& f) { decodePlanes(f, false); }
+static void stageDecodePlanesTrusted(Frame& f) { decodePlanes(f, true); }
+
+// Streamed into the histogram, on one thread and pipelined over two
+static unsigned addRow(void* accumulator, unsigned, unsigned w, const unsigned char* const* rows)
+{
+  ((NDVIAccumulator*) accumulator)->addRow(rows[0], rows[1], (int) w);
+  return 0;
+}
+
+static void decodeRows(Frame& f, bool pipelined)
+{
+  unsigned w, h;
+  lodepng::State state;
+  NDVIAccumulator accumulator;
+  const unsigned channels[2] = { 0, 2 };
+  if(pipelined)
+    decodeRowsPipelined(channels, 2, w, h, state, &f.png[0], f.png.size(), addRow, &accumulator);
+  else
+    lodepng_decode_rows(channels, 2, &w, &h, &state, &f.png[0], f.png.size(), addRow, &accumulator);
+  accumulator.finish(f.analysis);
+}
+
+static void stageDecodeRows(Frame& f) { decodeRows(f, false); }
+static void stageDecodeRowsPipelined(Frame& f) { decodeRows(f, true); }
+
+// A whole frame as planthealth -o processes it (decode, analyse, render, encode), every buffer from the
+// frame's arena
+static void stageFrameArena(Frame& f)
+{
+  FrameArena& a = *f.arena;
+  FrameArena* previous = frameArena();
+  useFrameArena(&a);
+
+  unsigned w, h;
+  lodepng::State state;
+  const unsigned channels[2] = { 0, 2 };
+  unsigned error = lodepng_inspect(&w, &h, &state, &f.png[0], f.png.size());
+  if(!error){
+    a.ir.resize((size_t) w * h);
+    a.blue.resize((size_t) w * h);
+    unsigned char* planes[2] = { &a.ir[0], &a.blue[0] };
+    error = lodepng_decode_planes_into(planes, a.ir.size(), channels, 2, &w, &h, &state, &f.png[0], f.png.size());
+  }
+  if(!error){
+    analyseNDVI(a.ir, a.blue, (int) w, (int) h, a.analysis, f.pool);
+    renderNDVI(a.ir, a.blue, (int) w, (int) h, a.analysis, a.greyscale, f.pool);
+    unsigned char* png = 0;
+    size_t pngsize = 0;
+    state.encoder.auto_convert = 0;
+    state.info_raw.colortype = state.info_png.color.colortype = LCT_GREY;
+    state.info_raw.bitdepth = state.info_png.color.bitdepth = 8;
+    lodepng_encode(&png, &pngsize, &a.greyscale[0], w, h, &state);
+    lodepng_free(png);
+  }
+
+  useFrameArena(previous);
+}
+
+// Fused engine
+static void stageAnalyse(Frame& f) { analyseNDVI(f.ir, f.blue, f.Width, f.Height, f.analysis, f.pool); }
+static void stageAnalyseHistogram(Frame& f) { analyseNDVIHistogram(f.ir, f.blue, f.Width, f.Height, f.analysis, f.pool); }
+static void stageRenderNDVI(Frame& f) { f.greyscale = renderNDVI(f.ir, f.blue, f.Width, f.Height, f.analysis, f.pool); }
+static void stageRenderMask(Frame& f) { f.bitmap = renderMask(f.ir, f.blue, f.Width, f.Height, f.analysis, f.pool); }
+
+// A single kernel set
+static void kernelNDVI(Frame& f) { f.kernels->ndvi(&f.image[0], &f.ndvi[0], f.pixels()); }
+static void kernelScale(Frame& f)
+{
+  f.kernels->scale(&f.ndvi[0], &f.scaled[0], f.pixels(), f.min, (double) f.max - f.min);
+}
+static void kernelThreshold(Frame& f) { f.kernels->threshold(&f.scaled[0], f.bitmap.words(), f.pixels(), f.threshold); }
+static void kernelExpand(Frame& f) { f.kernels->expand(&f.greyscale[0], &f.rgba[0], f.pixels()); }
+static void kernelPairs(Frame& f) { f.kernels->pairs(&f.ir[0], &f.blue[0], &f.pairs[0], f.pixels()); }
+static void kernelMinMax(Frame& f) { f.kernels->minMax(&f.ndvi[0], f.pixels(), &f.min, &f.max); }
+static void kernelPack(Frame& f) { f.kernels->pack(&f.flags[0], f.bitmap.words(), f.pixels()); }
+
+// A single codec, decoding the PNG lodepng_encode wrote
+static void codecEncode(Frame& f)
+{
+  lodepng::State state;
+  usePNGCodec(*f.codec, &state);
+  f.codecPng.clear();
+  lodepng::encode(f.codecPng, f.image, f.Width, f.Height, state);
+}
+static void codecDecodePlanes(Frame& f)
+{
+  unsigned w, h;
+  lodepng::State state;
+  usePNGCodec(*f.codec, &state);
+  std::vector<unsigned char> planes[2];
+  const unsigned channels[2] = { 0, 2 };
+  planes[0].swap(f.ir);
+  planes[1].swap(f.blue);
+  lodepng::decode_planes_into(planes, channels, 2, w, h, state, &f.png[0], f.png.size());
+  f.ir.swap(planes[0]);
+  f.blue.swap(planes[1]);
+}
+
+
+// Benchmark settings
+static int maxIterations = 10;
+static double maxSeconds = 1.0;
+static const int MIN_ITERATIONS = 3;
+
+
+// Time a stage and print its line. bytes is what the stage reads and writes over the whole frame.
+static void bench(Frame& frame, const std::string& stage, StageFunction function, double bytes)
+{
+  std::vector<double> times;
+  double started = StageTimings::now();
+  while((int) times.size() < MIN_ITERATIONS || ((int) times.size() < maxIterations && StageTimings::now() - started < maxSeconds)){
+    double t0 = StageTimings::now();
+    function(frame);
+    times.push_back(StageTimings::now() - t0);
+  }
+
+  std::sort(times.begin(), times.end());
+  size_t n = times.size();
+  double median = n % 2 ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+  double p95 = times[(size_t) ceil(0.95 * n) - 1];
+  double mp = frame.pixels() / 1e6;
+  printf("bench frame=%s MP=%.1f stage=%s iterations=%lu median_ms=%.3f p95_ms=%.3f MP/s=%.1f B/px=%.3f\n",
+         frame.name.c_str(), mp, stage.c_str(), (unsigned long) n, median * 1e3, p95 * 1e3,
+         median > 0.0 ? mp / median : 0.0, bytes / frame.pixels());
+  fflush(stdout);
+}
+
+
+// Run every stage on a frame whose image is filled in
+static void benchFrame(Frame& frame)
+{
+  const double n = (double) frame.pixels();
+
+  // Reference stages, in the order planthealth used to run them
+  bench(frame, "calculateNDVI", stageNDVI, 8 * n);
+  bench(frame, "minMax", stageMinMax, 4 * n);
+  bench(frame, "scaleImage", stageScale, 8 * n);
+  bench(frame, "otsu_threshold", stageOtsu, 4 * n);
+  bench(frame, "thresholdImage", stageThreshold, 4.125 * n);
+  bench(frame, "sumVegetationIndex", stageSum, 4.125 * n);
+  frame.greyscale.assign(frame.scaled.begin(), frame.scaled.end());
+  bench(frame, "greyscale2RGB", stageGreyscale2RGB, 5 * n);
+
+  // Every kernel set this CPU supports
+  const char* sets[] = { "scalar", "sse2", "avx2", "neon" };
+  for (int s=0; s<4; s++){
+    frame.kernels = ndviKernelSet(sets[s]);
+    if(!frame.kernels)
+      continue;
+    std::string suffix = std::string("[") + sets[s] + "]";
+    bench(frame, "ndvi" + suffix, kernelNDVI, 8 * n);
+    bench(frame, "scale" + suffix, kernelScale, 8 * n);
+    bench(frame, "pairs" + suffix, kernelPairs, 4 * n);
+    bench(frame, "minmax" + suffix, kernelMinMax, 4 * n);
+    // pack overwrites the bitmap, which threshold then rebuilds for the stages after these
+    bench(frame, "pack" + suffix, kernelPack, 1.125 * n);
+    bench(frame, "threshold" + suffix, kernelThreshold, 4.125 * n);
+    bench(frame, "expand" + suffix, kernelExpand, 5 * n);
+  }
+
+  // PNG encode and decode; the encoded size only settles after the first encode
+  stageEncode(frame);
+  bench(frame, "lodepng_encode", stageEncode, 4 * n + frame.png.size());
+  bench(frame, "lodepng_decode", stageDecode, frame.png.size() + 4 * n);
+  bench(frame, "lodepng_decode_planes", stageDecodePlanes, frame.png.size() + 2 * n);
+  bench(frame, "lodepng_decode_planes_trusted", stageDecodePlanesTrusted, frame.png.size() + 2 * n);
+  bench(frame, "decode_rows_histogram", stageDecodeRows, frame.png.size());
+  bench(frame, "decode_rows_pipelined", stageDecodeRowsPipelined, frame.png.size());
+  stageEncodeNDVIRGBA(frame);
+  bench(frame, "encode_ndvi_rgba", stageEncodeNDVIRGBA, 9 * n + frame.codecPng.size());
+  stageEncodeNDVIGrey(frame);
+  bench(frame, "encode_ndvi_grey", stageEncodeNDVIGrey, n + frame.codecPng.size());
+  stageEncodeMaskGrey1(frame);
+  bench(frame, "encode_mask_grey1", stageEncodeMaskGrey1, 0.375 * n + frame.codecPng.size());
+
+  // Every encoder preset on the NDVI output, each followed by the size it writes
+  const char* levels[] = { "store", "fast", "default", "max" };
+  for (int l=0; l<4; l++){
+    frame.level = pngLevelByName(levels[l]);
+    std::string stage = std::string("encode_level[") + levels[l] + "]";
+    levelEncode(frame);
+    bench(frame, stage, levelEncode, n + frame.codecPng.size());
+    printf("size frame=%s MP=%.1f stage=%s bytes=%lu bits_per_pixel=%.3f\n", frame.name.c_str(), n / 1e6,
+           stage.c_str(), (unsigned long) frame.codecPng.size(), 8.0 * frame.codecPng.size() / n);
+    fflush(stdout);
+  }
+  frame.level = &pngLevel();
+  stageEncodeParallel(frame);
+  bench(frame, "encode_parallel", stageEncodeParallel, n + frame.codecPng.size());
+  printf("size frame=%s MP=%.1f stage=encode_parallel bytes=%lu bits_per_pixel=%.3f\n", frame.name.c_str(), n / 1e6,
+         (unsigned long) frame.codecPng.size(), 8.0 * frame.codecPng.size() / n);
+  fflush(stdout);
+
+  // Every codec built in
+  const char* codecs[] = { "lodepng", "zlib", "fast" };
+  for (int c=0; c<3; c++){
+    frame.codec = pngCodecByName(codecs[c]);
+    if(!frame.codec)
+      continue;
+    std::string suffix = std::string("[") + codecs[c] + "]";
+    codecEncode(frame);
+    bench(frame, "encode" + suffix, codecEncode, 4 * n + frame.codecPng.size());
+    bench(frame, "decode_planes" + suffix, codecDecodePlanes, frame.png.size() + 2 * n);
+  }
+
+  // A whole frame from an arena: the first one fills it, after that no heap allocation should remain
+  FrameArena arena;
+  frame.arena = &arena;
+  size_t news = newCount;
+  stageFrameArena(frame);
+  ArenaStats first = arena.stats();
+  size_t firstNews = newCount - news;
+  bench(frame, "frame_arena", stageFrameArena, frame.png.size() + 7 * n);
+  arena.resetStats();
+  news = newCount;
+  stageFrameArena(frame);
+  ArenaStats steady = arena.stats();
+  printf("alloc frame=%s MP=%.1f stage=frame_arena first_heap_allocations=%lu first_heap_bytes=%lu first_new=%lu "
+         "steady_heap_allocations=%lu steady_heap_bytes=%lu steady_new=%lu requests=%lu\n",
+         frame.name.c_str(), n / 1e6, (unsigned long) first.heapAllocations, (unsigned long) first.heapBytes,
+         (unsigned long) firstNews, (unsigned long) steady.heapAllocations, (unsigned long) steady.heapBytes,
+         (unsigned long) (newCount - news), (unsigned long) steady.requests);
+  fflush(stdout);
+  frame.arena = 0;
+
+  // Fused engine on the planes
+  bench(frame, "analyseNDVI", stageAnalyse, 4 * n);
+  bench(frame, "analyseNDVIHistogram", stageAnalyseHistogram, 2 * n);
+  bench(frame, "renderNDVI", stageRenderNDVI, 3 * n);
+  bench(frame, "renderMask", stageRenderMask, 2.125 * n);
+}
+
+
+// Width and height of a 4:3 frame of about megapixels
+static void frameSize(double megapixels, int& Width, int& Height)
+{
+  Width = (int) (sqrt(megapixels * 1e6 * 4 / 3) + 0.5);
+  Height = (int) (Width * 3 / 4.0 + 0.5);
+  if(Width < 1)
+    Width = 1;
+  if(Height < 1)
+    Height = 1;
+}
+
+
+// Synthetic infrablue frame: bright IR leaves on a darker background with noise and a few black pixels
+static void syntheticFrame(Frame& frame)
+{
+  unsigned seed = 12345;
+  frame.image.resize(4 * frame.pixels());
+  for (int y=0; y<frame.Height; y++){
+    for (int x=0; x<frame.Width; x++){
+      seed = seed * 1103515245u + 12345u;
+      int noise = (seed >> 16) & 31;
+      bool leaf = sin(x * 0.01) * cos(y * 0.013) > 0.2;
+      unsigned char* px = &frame.image[4 * ((size_t) y * frame.Width + x)];
+      px[0] = (unsigned char) (leaf ? 180 + noise : 90 + noise);
+      px[1] = (unsigned char) (60 + noise);
+      px[2] = (unsigned char) (leaf ? 70 + noise : 100 + noise);
+      px[3] = 255;
+      if(noise == 0)
+        px[0] = px[2] = 0;
+    }
+  }
+}
+
+
+// Real frame mirrored and tiled to the frame size, so it keeps its statistics at every size
+static void tiledFrame(Frame& frame, const std::vector<unsigned char>& source, int sourceWidth, int sourceHeight)
+{
+  frame.image.resize(4 * frame.pixels());
+  for (int y=0; y<frame.Height; y++){
+    int sy = y % (2 * sourceHeight);
+    if(sy >= sourceHeight)
+      sy = 2 * sourceHeight - 1 - sy;
+    for (int x=0; x<frame.Width; x++){
+      int sx = x % (2 * sourceWidth);
+      if(sx >= sourceWidth)
+        sx = 2 * sourceWidth - 1 - sx;
+      const unsigned char* src = &source[4 * ((size_t) sy * sourceWidth + sx)];
+      unsigned char* dst = &frame.image[4 * ((size_t) y * frame.Width + x)];
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+      dst[3] = src[3];
+    }
+  }
+}
+
+
+// Size the kernel buffers and the fused engine input, which the stages only overwrite
+static void prepareFrame(Frame& frame, ThreadPool* pool)
+{
+  frame.ndvi.resize(frame.pixels());
+  frame.scaled.resize(frame.pixels());
+  frame.rgba.resize(4 * frame.pixels());
+  frame.bitmap.resize(frame.Width, frame.Height);
+  frame.ir.resize(frame.pixels());
+  frame.blue.resize(frame.pixels());
+  frame.pairs.resize(frame.pixels());
+  frame.flags.resize(frame.pixels());
+  for (size_t i=0; i<frame.pixels(); i++){
+    frame.ir[i] = frame.image[4 * i + 0];
+    frame.blue[i] = frame.image[4 * i + 2];
+    frame.flags[i] = frame.ir[i] > frame.blue[i];
+  }
+  frame.min = frame.max = frame.sum = 0.0f;
+  frame.threshold = 0;
+  frame.kernels = &ndviKernels();
+  frame.codec = &pngCodec();
+  frame.level = &pngLevel();
+  frame.arena = 0;
+  frame.pool = pool;
+}
+
+
+// Displays help message.
+static int help(void)
+{
+  fprintf(stderr,
+          "Usage: planthealth_bench [-h] [-i iterations] [-B seconds] [-j threads] [-s sizes] [-f frame.png]...\n"
+          "\t-h Display this help message.\n"
+          "\t-i Most iterations per stage (default 10, at least 3 are run).\n"
+          "\t-B Budget of seconds per stage after which no more iterations are started (default 1).\n"
+          "\t-j Threads for the fused engine stages (default: one per processor).\n"
+          "\t-s Comma separated frame sizes in megapixels (default 0.3,12).\n"
+          "\t-f A real PNG frame, tiled to each size. May be repeated.\n");
+  exit(0);
+}
+
+
+int main(int argc, char **argv)
+{
+  int optch;
+  int threads = ThreadPool::processors();
+  std::vector<double> sizes;
+  std::vector<const char*> files;
+
+  while ((optch = getopt(argc, argv, ":hi:B:j:s:f:")) != EOF)
+    switch (optch) {
+    case 'i':
+      maxIterations = atoi(optarg);
+      break;
+    case 'B':
+      maxSeconds = atof(optarg);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      if(threads < 1)
+        help();
+      break;
+    case 's':
+      for (char* size=strtok(optarg, ","); size; size=strtok(0, ","))
+        sizes.push_back(atof(size));
+      break;
+    case 'f':
+      files.push_back(optarg);
+      break;
+    default:
+      help();
+      break;
+    }
+  if(optind != argc)
+    help();
+  if(sizes.empty()){
+    const double defaults[] = { 0.3, 12 };
+    sizes.assign(defaults, defaults + 2);
+  }
+
+  // The real frames, decoded once
+  std::vector<std::vector<unsigned char> > sources(files.size());
+  std::vector<unsigned> sourceWidth(files.size()), sourceHeight(files.size());
+  for (size_t i=0; i<files.size(); i++){
+    unsigned error = lodepng::decode(sources[i], sourceWidth[i], sourceHeight[i], files[i]);
+    if(error){
+      fprintf(stderr, "%s: decoder error %u: %s\n", files[i], error, lodepng_error_text(error));
+      return 1;
+    }
+  }
+
+  ThreadPool pool(threads);
+  printf("# kernels=%s threads=%d\n", ndviKernels().name, pool.size());
+
+  for (size_t s=0; s<sizes.size(); s++){
+    for (size_t f=0; f<=files.size(); f++){
+      Frame frame;
+      frameSize(sizes[s], frame.Width, frame.Height);
+      if(f == 0){
+        frame.name = "synthetic";
+        syntheticFrame(frame);
+      }
+      else{
+        std::string path = files[f - 1];
+        frame.name = path.substr(path.find_last_of('/') + 1);
+        tiledFrame(frame, sources[f - 1], sourceWidth[f - 1], sourceHeight[f - 1]);
+      }
+      prepareFrame(frame, &pool);
+      benchFrame(frame);
+    }
+  }
+  return 0;
+}
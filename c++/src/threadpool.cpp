@@ -0,0 +1,125 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      threadpool.cpp
+   Description: Fixed size pool of POSIX threads that runs indexed tasks, e.g. one per row band
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <unistd.h>
+#include "threadpool.h"
+
+
+ThreadPool::ThreadPool(int threads)
+  : nthreads(1), task(0), arg(0), count(0), next(0), active(0), generation(0), stopping(false)
+{
+  pthread_mutex_init(&mutex, 0);
+  pthread_cond_init(&start, 0);
+  pthread_cond_init(&done, 0);
+
+  if(threads < 1)
+    threads = 1;
+  this->threads.resize(threads - 1);
+  workers.resize(threads - 1);
+  for (int i=0; i<threads - 1; i++){
+    workers[i].pool = this;
+    workers[i].id = i + 1;
+    if(pthread_create(&this->threads[i], 0, workerMain, &workers[i]) != 0)
+      break; // carry on with the threads we did get
+    nthreads++;
+  }
+  this->threads.resize(nthreads - 1);
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&start);
+  pthread_mutex_unlock(&mutex);
+  for (size_t i=0; i<threads.size(); i++)
+    pthread_join(threads[i], 0);
+
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&start);
+  pthread_mutex_destroy(&mutex);
+}
+
+
+int ThreadPool::processors()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n < 1 ? 1 : (int) n;
+}
+
+
+void ThreadPool::run(Task task, void* arg, int count)
+{
+  pthread_mutex_lock(&mutex);
+  this->task = task;
+  this->arg = arg;
+  this->count = count;
+  next = 0;
+  active = nthreads - 1;
+  generation++;
+  pthread_cond_broadcast(&start);
+  pthread_mutex_unlock(&mutex);
+
+  work(0);
+
+  pthread_mutex_lock(&mutex);
+  while(active > 0)
+    pthread_cond_wait(&done, &mutex);
+  pthread_mutex_unlock(&mutex);
+}
+
+
+// Take task indices until there are none left
+void ThreadPool::work(int worker)
+{
+  for(;;){
+    pthread_mutex_lock(&mutex);
+    int index = next < count ? next++ : count;
+    pthread_mutex_unlock(&mutex);
+    if(index >= count)
+      break;
+    task(arg, index, worker);
+  }
+}
+
+
+void* ThreadPool::workerMain(void* worker)
+{
+  ThreadPool* pool = ((Worker*) worker)->pool;
+  int id = ((Worker*) worker)->id;
+  unsigned seen = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+  for(;;){
+    while(pool->generation == seen && !pool->stopping)
+      pthread_cond_wait(&pool->start, &pool->mutex);
+    if(pool->stopping)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool->work(id);
+
+    pthread_mutex_lock(&pool->mutex);
+    if(--pool->active == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+
+void runTasks(ThreadPool* pool, ThreadPool::Task task, void* arg, int count)
+{
+  if(pool && pool->size() > 1){
+    pool->run(task, arg, count);
+    return;
+  }
+  for (int index=0; index<count; index++)
+    task(arg, index, 0);
+}
@@ -0,0 +1,64 @@
+/*--------------------------------------------------------------------------------------------------------------
+   Module:      timings.cpp
+   Description: Monotonic wall clock timings of the stages of a run, reported with -t/--timings
+   Language:    C++
+  --------------------------------------------------------------------------------------------------------------*/
+
+// Includes
+#include <time.h>
+#include "timings.h"
+
+
+StageTimings::StageTimings()
+  : current(0), started(0.0), created(now())
+{
+}
+
+
+double StageTimings::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+void StageTimings::start(const char* stage)
+{
+  current = stage;
+  started = now();
+}
+
+
+void StageTimings::stop(size_t bytes, size_t pixels)
+{
+  Stage stage;
+  stage.seconds = now() - started;
+  stage.name = current ? current : "unnamed";
+  stage.bytes = bytes;
+  stage.pixels = pixels;
+  stages.push_back(stage);
+  current = 0;
+}
+
+
+static void reportStage(FILE* out, const char* name, double seconds, size_t bytes, size_t pixels)
+{
+  double mbs = seconds > 0.0 ? bytes / seconds / 1e6 : 0.0;
+  double mps = seconds > 0.0 ? pixels / seconds / 1e6 : 0.0;
+  fprintf(out, "timing stage=%s seconds=%.6f bytes=%lu pixels=%lu MB/s=%.2f MP/s=%.2f\n",
+          name, seconds, (unsigned long) bytes, (unsigned long) pixels, mbs, mps);
+}
+
+
+void StageTimings::report(FILE* out) const
+{
+  size_t pixels = 0;
+  for (size_t i=0; i<stages.size(); i++){
+    reportStage(out, stages[i].name, stages[i].seconds, stages[i].bytes, stages[i].pixels);
+    if(stages[i].pixels > pixels)
+      pixels = stages[i].pixels;
+  }
+  // the total is the whole run so far, including anything between the stages, and its rate is per frame
+  reportStage(out, "total", now() - created, 0, pixels);
+}